@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs the programs in tests and compares what they print, stdout and stderr, with the .out file next to each
+# Usage: bench/check.sh [-b binary] [test.rain...]
+# With no scripts every program in tests is run, the exit status is the number of failures
+
+BIN=bin/rain
+while getopts "b:" opt
+do
+    case $opt in
+        b) BIN=$OPTARG ;;
+        *) exit 64 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -eq 0 ]
+then
+    set -- tests/*.rain
+fi
+
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+failed=0
+for script in "$@"
+do
+    expected="${script%.rain}.out"
+    "$BIN" "$script" > "$out" 2>&1
+    if diff "$expected" "$out" > /dev/null
+    then
+        printf "%-24s ok\n" "$script"
+    else
+        printf "%-24s FAILED\n" "$script"
+        diff "$expected" "$out" | head -20
+        failed=$((failed + 1))
+    fi
+done
+echo "$failed failed"
+exit $failed
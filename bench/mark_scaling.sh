@@ -0,0 +1,20 @@
+#!/bin/sh
+# Prints the collector pauses of rain scripts marked with 1, 2, 4 and 8 threads
+# Usage: bench/mark_scaling.sh [-b binary] script.rain...
+# The binary must be built with DEBUG_GC_PAUSES defined in include/common.h
+
+BIN=bin/rain
+while getopts "b:" opt
+do
+    case $opt in
+        b) BIN=$OPTARG ;;
+        *) exit 64 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+for threads in 1 2 4 8
+do
+    echo "gc threads $threads"
+    RAIN_GC_THREADS=$threads "$(dirname "$0")/pauses.sh" -b "$BIN" "$@"
+done
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Prints percentiles of the collector pauses of rain scripts
+# Usage: bench/pauses.sh [-b binary] script.rain...
+# The binary must be built with DEBUG_GC_PAUSES defined in include/common.h
+
+BIN=bin/rain
+while getopts "b:" opt
+do
+    case $opt in
+        b) BIN=$OPTARG ;;
+        *) exit 64 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+for script in "$@"
+do
+    "$BIN" "$script" 2>&1 > /dev/null | awk '$1 == "gc" && $2 == "pause" { print $3 }' | sort -n | awk -v name="$script" '
+        function pct(p,    i) { i = int(NR * p + 0.5); return t[i < 1 ? 1 : i] }
+        { t[NR] = $1; sum += $1 }
+        END {
+            if(NR == 0) { printf "%-24s no pauses\n", name; exit }
+            printf "%-24s %7d pauses  total %7d us  p50 %5d us  p90 %5d us  p99 %6d us  max %6d us\n", name, NR, sum, pct(0.5), pct(0.9), pct(0.99), t[NR]
+        }'
+done
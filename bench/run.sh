@@ -0,0 +1,33 @@
+#!/bin/sh
+# Times rain scripts and prints the best and median wall clock time of several runs
+# Usage: bench/run.sh [-n runs] [-b binary] script.rain...
+# Use the default release build, make PROFILE=debug numbers are unoptimised
+
+RUNS=5
+BIN=bin/rain
+while getopts "n:b:" opt
+do
+    case $opt in
+        n) RUNS=$OPTARG ;;
+        b) BIN=$OPTARG ;;
+        *) exit 64 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+for script in "$@"
+do
+    times=""
+    i=0
+    while [ $i -lt $RUNS ]
+    do
+        start=$(date +%s%N)
+        "$BIN" "$script" > /dev/null
+        end=$(date +%s%N)
+        times="$times $(( (end - start) / 1000000 ))"
+        i=$((i + 1))
+    done
+    echo $times | tr ' ' '\n' | sort -n | awk -v name="$script" '
+        { t[NR] = $1 }
+        END { printf "%-24s best %6d ms  median %6d ms  (%d runs)\n", name, t[1], t[int((NR + 1) / 2)], NR }'
+done
@@ -1,9 +1,7 @@
 #ifndef RAIN_CALL_STACK_H
 #define RAIN_CALL_STACK_H
 
-#define STACK_CALLER (-4)
-#define STACK_RET_ADDR (-3)
-#define STACK_PREV_STACK_BASE (-2)
-#define STACK_PREV_CALL_BASE (-1)
+// slot of the called function or closure below a function's stack base, the rest of its frame is in vm.frames
+#define STACK_CALLER (-1)
 
 #endif
@@ -85,7 +85,7 @@ typedef enum
     OP_INDEX_PEEK,
     OP_INDEX_SET,
     OP_CALL,
-    OP_PUSH_CALL_BASE,
+    OP_TAIL_CALL,
     OP_CLOSURE_BYTE,
     OP_CLOSURE_SHORT,
     OP_CLOSURE_WORD,
@@ -119,9 +119,135 @@ typedef enum
     OP_ATTR_SET_THIS_SHORT,
     OP_ATTR_SET_THIS_WORD,
     OP_ATTR_SET_THIS_LONG,
+    OP_INVOKE_BYTE,
+    OP_INVOKE_SHORT,
+    OP_INVOKE_WORD,
+    OP_INVOKE_LONG,
+    OP_INVOKE_THIS_BYTE,
+    OP_INVOKE_THIS_SHORT,
+    OP_INVOKE_THIS_WORD,
+    OP_INVOKE_THIS_LONG,
+    OP_BUILD_STRING_BYTE,
+    OP_BUILD_STRING_SHORT,
+    OP_BUILD_STRING_WORD,
+    OP_BUILD_STRING_LONG,
     OP_EXIT,
+
+    // type specialised opcodes, only produced by quickening decoded instructions at runtime
+    OP_ADD_INT_INT,
+    OP_ADD_FLOAT_FLOAT,
+    OP_SUB_INT_INT,
+    OP_SUB_FLOAT_FLOAT,
+    OP_MUL_INT_INT,
+    OP_MUL_FLOAT_FLOAT,
+    OP_DIV_INT_INT,
+    OP_DIV_FLOAT_FLOAT,
+    OP_GREATER_INT_INT,
+    OP_GREATER_FLOAT_FLOAT,
+    OP_LESS_INT_INT,
+    OP_LESS_FLOAT_FLOAT,
+
+    // superinstructions, only produced by decode_chunk
+    OP_INC_LOCAL,
+    OP_INC_GLOBAL,
+    OP_LOCAL_LESS_CONST_JUMP_IF_FALSE,
+    OP_LOCAL_LESS_EQL_CONST_JUMP_IF_FALSE,
+    OP_SET_LOCAL_POP,
+    OP_SET_GLOBAL_POP,
+
+    // three operand superinstructions, only produced by decode_chunk
+    OP_REG_ADD,
+    OP_REG_SUB,
+    OP_REG_MUL,
+    OP_REG_EQL,
+    OP_REG_LESS,
+    OP_REG_GREATER,
+
+    // width independent opcodes used by the decoded instruction stream
+    OP_CONST = OP_CONST_BYTE,
+    OP_GET_GLOBAL = OP_GET_GLOBAL_BYTE,
+    OP_SET_GLOBAL = OP_SET_GLOBAL_BYTE,
+    OP_GET_UPVALUE = OP_GET_UPVALUE_BYTE,
+    OP_SET_UPVALUE = OP_SET_UPVALUE_BYTE,
+    OP_GET_LOCAL = OP_GET_LOCAL_BYTE,
+    OP_SET_LOCAL = OP_SET_LOCAL_BYTE,
+    OP_JUMP_IF_FALSE = OP_JUMP_IF_FALSE_BYTE,
+    OP_JUMP_IF_TRUE = OP_JUMP_IF_TRUE_BYTE,
+    OP_JUMP = OP_JUMP_BYTE,
+    OP_CLOSURE = OP_CLOSURE_BYTE,
+    OP_ATTR = OP_ATTR_BYTE,
+    OP_ATTR_GET = OP_ATTR_GET_BYTE,
+    OP_ATTR_PEEK = OP_ATTR_PEEK_BYTE,
+    OP_ATTR_SET = OP_ATTR_SET_BYTE,
+    OP_ATTR_GET_THIS = OP_ATTR_GET_THIS_BYTE,
+    OP_ATTR_PEEK_THIS = OP_ATTR_PEEK_THIS_BYTE,
+    OP_ATTR_SET_THIS = OP_ATTR_SET_THIS_BYTE,
+    OP_INVOKE = OP_INVOKE_BYTE,
+    OP_INVOKE_THIS = OP_INVOKE_THIS_BYTE,
+    OP_BUILD_STRING = OP_BUILD_STRING_BYTE,
 } Opcode;
 
+/* Decoded instruction
+ * The bytecode is decoded once before it is run so the interpreter never parses operand bytes
+ * op is the width independent opcode (OP_CONST rather than OP_CONST_BYTE ... OP_CONST_LONG)
+ * and backward jumps become OP_JUMP
+ * arithmetic and comparison ops are rewritten in place by the VM to type specialised
+ * variants once their operand types are seen, and back again on a type miss
+ * the first instruction of some common sequences is replaced by a superinstruction, see fuse_insts
+ * arg is the constant, global, local or upvalue index, the index of the instruction jumped to
+ * the number of pieces joined by OP_BUILD_STRING or the packed operands of a register op
+ * scope is the visibility byte of OP_ATTR
+ * args is the number of arguments passed by OP_CALL, OP_TAIL_CALL, OP_INVOKE and OP_INVOKE_THIS
+ * offset is the offset of the instruction in the bytecode, used for line numbers
+ * cache is the index of the inline cache of attribute instructions in the chunk's attr_caches
+ * handler is the address of the code that runs the instruction when using computed gotos
+*/
+typedef struct
+{
+#ifdef COMPUTED_GOTO
+    void* handler;
+#endif
+    size_t arg;
+    size_t offset;
+    inst_type op;
+    uint8_t scope;
+    uint8_t args;
+    uint32_t cache;
+} Inst;
+
+/* Register operands
+ * A register op packs three 16 bit operands into arg, a destination and two sources
+ * A source is a local slot, or a constant index when REG_CONST is set
+ * The destination is a local slot, or REG_PUSH to push the result like the stack op would
+*/
+#define REG_CONST 0x8000
+#define REG_PUSH 0xffff
+// largest local or constant index a register operand can hold
+#define REG_MAX 0x7fff
+#define REG_DST(inst) ((size_t)((inst)->arg & 0xffff))
+#define REG_SRC1(inst) ((size_t)(((inst)->arg >> 16) & 0xffff))
+#define REG_SRC2(inst) ((size_t)(((inst)->arg >> 32) & 0xffff))
+#define REG_PACK(dst, src1, src2) ((size_t)(dst) | ((size_t)(src1) << 16) | ((size_t)(src2) << 32))
+
+/* Inline caches
+ * An attribute instruction remembers where the attribute was found in the class attribute table
+ * for the last few classes of instances it saw, a hit is confirmed by checking the key stored
+ * at that index so stale entries are just misses
+ * Entries are only cached once the visibility checks of the instruction have passed
+*/
+#define ATTR_CACHE_WAYS 4
+
+typedef struct
+{
+    Obj* klass;
+    size_t index;
+} AttrCacheEntry;
+
+typedef struct
+{
+    AttrCacheEntry ways[ATTR_CACHE_WAYS];
+} AttrCache;
+
 typedef struct
 {
     size_t start_line;
@@ -129,6 +255,11 @@ typedef struct
     size_t capacity;
     size_t entry;
     inst_type* code;
+    size_t insts_size;
+    size_t insts_capacity;
+    Inst* insts;
+    size_t attr_caches_size;
+    AttrCache* attr_caches;
     LineArray line_encoding;
     ValueArray consts;
     ValueArray globals;
@@ -170,8 +301,20 @@ void write_chunk_attr_get_this(Chunk* chunk, size_t const_index, size_t line);
 void write_chunk_attr_peek_this(Chunk* chunk, size_t const_index, size_t line);
 // writes an attribute set this instruction to the bytecode
 void write_chunk_attr_set_this(Chunk* chunk, size_t const_index, size_t line);
+// writes a call instruction passing args arguments to the bytecode
+void write_chunk_call(Chunk* chunk, uint8_t args, size_t line);
+// writes a method invoke instruction to the bytecode
+void write_chunk_invoke(Chunk* chunk, size_t const_index, uint8_t args, size_t line);
+// writes a method invoke on this instruction to the bytecode
+void write_chunk_invoke_this(Chunk* chunk, size_t const_index, uint8_t args, size_t line);
+// writes an instruction joining the top count values into one string to the bytecode
+void write_chunk_build_string(Chunk* chunk, size_t count, size_t line);
 // reads a constant index from the bytecode
 size_t read_chunk_const(inst_type* inst, size_t* offset, size_t off_size);
+// decodes the bytecode into the fixed width instruction stream in insts
+void decode_chunk(Chunk* chunk);
+// gets the index of the decoded instruction at an offset in the bytecode
+size_t get_inst_index(Chunk* chunk, size_t offset);
 // frees a chunk of bytecode
 void free_chunk(Chunk* chunk);
 // passes global variables and constants between chunks
@@ -6,10 +6,20 @@
 #include <stdint.h>
 
 #define LONG64
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+#if defined(__GNUC__) || defined(__clang__)
+#define COMPUTED_GOTO
+#endif
+#define NAN_BOXING
+#define INCREMENTAL_GC
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__unix__)
+#define PARALLEL_MARK
+#endif
 #undef DEBUG_STRESS_GC
+// debug builds also log every object allocated, marked, promoted and freed under --gc-log
+#ifdef RAIN_DEBUG
 #define DEBUG_LOG_GC
+#endif
+#undef DEBUG_GC_PAUSES
 #undef DEBUG_TOKEN_TYPES
 
 #endif
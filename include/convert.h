@@ -15,4 +15,12 @@ char* int_to_oct_str(int64_t num);
 char* int_to_bin_str(int64_t num);
 char* float_to_str(double num);
 
+// most characters written by the buffer variants below, which do not null terminate
+#define INT_DEC_STR_MAX 20
+#define FLOAT_STR_MAX 24
+
+// writes num into buffer and returns the number of characters written
+size_t int_to_dec_buffer(int64_t num, char* buffer);
+size_t float_to_buffer(double num, char* buffer);
+
 #endif
@@ -0,0 +1,11 @@
+#ifndef RAIN_HASH_H
+#define RAIN_HASH_H
+
+#include <common.h>
+
+// picks the random seed of hash_bytes, must run before any string is hashed
+void init_hash_seed();
+// seeded hash of len bytes, read a word at a time
+uint32_t hash_bytes(const char* bytes, size_t len);
+
+#endif
@@ -40,9 +40,22 @@ typedef struct {
     VarValue var;
 } Entry;
 
+// control bytes probed together, capacities are powers of two of at least this many slots
+#define HASH_GROUP_SIZE 16
+
+/* Swiss table
+ * Each slot has a control byte, kept apart from the entries, holding 7 bits of the key's
+ * hash when full or marking it empty or deleted. A lookup compares a whole group of
+ * control bytes against the hash at once and only touches the entries that match,
+ * stopping at the first group with an empty slot. Entries of unused slots have a NULL key
+ */
 typedef struct {
+    // live entries
     size_t count;
+    // deleted slots, which still lengthen probes until the next resize
+    size_t deleted;
     size_t capacity;
+    uint8_t* ctrl;
     Entry* entries;
 } HashTable;
 
@@ -51,11 +64,17 @@ void free_hash_table(HashTable* table);
 bool hash_table_insert(HashTable* table, ObjString* key, uint8_t scope, Value value);
 bool hash_table_set(HashTable* table, ObjString* key, Value value);
 bool hash_table_get(HashTable* table, ObjString* key, Value* value);
+// NULL if not present
+Entry* hash_table_get_entry(HashTable* table, ObjString* key);
 // 0 -> not present, else scope + 1
 uint8_t hash_table_get_scope(HashTable* table, ObjString* key);
 bool hash_table_delete(HashTable* table, ObjString* key);
 void copy_hash_table(HashTable* from, HashTable* to);
+// exact copy into an empty table, every entry keeps its slot
+void clone_hash_table(HashTable* from, HashTable* to);
 ObjString* hash_table_find_str(HashTable* table, const char* chars, size_t len, uint32_t hash);
 void hash_table_remove_clear(HashTable* table);
+// forwards keys promoted out of the nursery and removes the rest
+void hash_table_remove_young(HashTable* table);
 
 #endif
@@ -0,0 +1,70 @@
+#ifndef RAIN_HEAP_H
+#define RAIN_HEAP_H
+
+#include <common.h>
+#include <value.h>
+
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_SLOT_ALIGN 8
+// larger objects get their own allocation
+#define HEAP_MAX_SLOT 256
+#define HEAP_SIZE_CLASSES (HEAP_MAX_SLOT / HEAP_SLOT_ALIGN)
+#define HEAP_PAGE_SLOTS (HEAP_PAGE_SIZE / HEAP_SLOT_ALIGN)
+
+/* Old space
+ * Small objects are carved out of aligned pages, one size class per page, so an
+ * object's page is found by masking its address. Each page keeps its own free
+ * list and a bitmap of the slots in use, which is how the collector enumerates
+ * objects. Large objects are kept on a doubly linked list
+ */
+typedef struct HeapPage {
+    struct HeapPage* next;
+    struct HeapPage* next_avail;
+    bool avail;
+    size_t slot_size;
+    size_t num_slots;
+    size_t live;
+    // slots from bump onwards have never been used
+    size_t bump;
+    void* free;
+    uint64_t used[HEAP_PAGE_SLOTS / 64];
+} HeapPage;
+
+typedef struct LargeObj {
+    struct LargeObj* prev;
+    struct LargeObj* next;
+} LargeObj;
+
+typedef struct {
+    // every page of each size class
+    HeapPage* pages[HEAP_SIZE_CLASSES];
+    // pages of each size class with free slots
+    HeapPage* avail[HEAP_SIZE_CLASSES];
+    LargeObj* large;
+    size_t num_pages;
+} Heap;
+
+// walks the objects of the old space, the last object returned may be freed
+typedef struct {
+    size_t size_class;
+    HeapPage* page;
+    size_t slot;
+    LargeObj* large;
+} HeapCursor;
+
+// initialises the old space
+void init_heap(Heap* heap);
+// allocates an object of size bytes in the old space
+Obj* heap_allocate(Heap* heap, size_t size);
+// returns an object of size bytes to the old space
+void heap_free(Heap* heap, Obj* obj, size_t size);
+// starts a walk over every object currently in the old space
+void heap_cursor_init(Heap* heap, HeapCursor* cursor);
+// next object of the walk, NULL once finished
+Obj* heap_cursor_next(Heap* heap, HeapCursor* cursor);
+// gives pages without any objects back to the system
+void heap_release_empty_pages(Heap* heap);
+// frees every page and large object
+void free_heap(Heap* heap);
+
+#endif
@@ -8,5 +8,9 @@ Value time_native(Value* args);
 Value print_native(Value* args);
 Value println_native(Value* args);
 Value input_native(Value* args);
+Value gc_stat_native(Value* args);
+Value gc_live_native(Value* args);
+Value gc_tune_native(Value* args);
+Value code_point_at_native(Value* args);
 
 #endif
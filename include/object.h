@@ -15,6 +15,9 @@
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+// string or rope
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value)  ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
@@ -29,34 +32,23 @@
 #define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
 
-typedef enum {
-    OBJ_STRING,
-    OBJ_ARRAY,
-    OBJ_FUNC,
-    OBJ_NATIVE,
-    OBJ_CLOSURE,
-    OBJ_UPVALUE,
-    OBJ_CLASS,
-    OBJ_INSTANCE,
-    OBJ_BOUND_METHOD,
-} ObjType;
-
-struct Obj {
-    struct Obj* next;
-    struct
-    {
-        ObjType type;
-        bool marked;
-        bool immortal;
-        bool defined;
-    } type_fields;
-};
+// ObjType and the Obj header are in value.h, so IS_INT can read an object's type inline
+
+// whether a string is plain ascii, found on its first index and kept in what would be padding
+typedef enum
+{
+    STR_UNCHECKED,
+    STR_ASCII,
+    STR_UTF8,
+} StrEncoding;
 
 struct ObjString {
     Obj obj;
     size_t len;
     uint32_t hash;
+    uint8_t encoding;
     char chars[];
 };
 
@@ -71,7 +63,10 @@ typedef struct
     Obj obj;
     ObjString* name;
     size_t offset;
+    size_t entry;
     size_t num_inputs;
+    // bound on the stack slots the body uses above its arguments
+    size_t max_stack;
 } ObjFunc;
 
 typedef struct
@@ -110,18 +105,27 @@ typedef struct
     NativeFn func;
 } ObjNative;
 
+/* Classes and instances
+ * A class is the shared layout of its instances
+ * attributes maps every attribute name to its scope and, for methods, the method itself
+ * or, for fields, the index of its slot as an int
+ * fields holds the default value of each field slot, which is copied into every new instance
+ * Instances only store their field slots, methods are always looked up on the class
+*/
 typedef struct
 {
     Obj obj;
     ObjString* name;
     HashTable attributes;
+    ValueArray fields;
 } ObjClass;
 
 typedef struct
 {
     Obj obj;
     ObjClass* klass;
-    HashTable attributes;
+    size_t num_fields;
+    Value fields[];
 } ObjInstance;
 
 typedef struct
@@ -131,6 +135,35 @@ typedef struct
     Obj* method;
 } ObjBoundMethod;
 
+// joins shorter than this are copied straight away
+#define ROPE_MIN_LEN 64
+
+/* Rope
+ * The result of joining strings with +, which only records its two halves. The
+ * characters are copied and interned the first time anything other than + needs them,
+ * so building a string piece by piece is linear. Ropes are never shorter than
+ * ROPE_MIN_LEN, shorter results are plain strings
+ */
+typedef struct
+{
+    Obj obj;
+    size_t len;
+    // each a string or a rope, NULL once flattened
+    Obj* left;
+    Obj* right;
+    // interned characters, NULL until flattened
+    ObjString* flat;
+} ObjRope;
+
+#ifdef NAN_BOXING
+// an int too large for the NaN boxed payload
+typedef struct
+{
+    Obj obj;
+    int64_t value;
+} ObjInt;
+#endif
+
 static inline bool is_obj_type(Value value, ObjType type)
 {
     return IS_OBJ(value) && AS_OBJ(value)->type_fields.type == type;
@@ -139,6 +172,17 @@ static inline bool is_obj_type(Value value, ObjType type)
 ObjString* take_str(char* chars, size_t len);
 ObjString* copy_str(const char* chars, size_t len);
 ObjString* concat_str(ObjString* a, ObjString* b);
+// joins two strings or ropes into a rope, or a string when the result is short
+Obj* concat_text(Obj* a, Obj* b);
+// joins the values as they would be printed, pieces which are not strings are replaced by their text
+Obj* build_text(Value* pieces, size_t count);
+// the character at a code point index of a utf-8 string, NULL if beyond its end
+// linear in index unless the string is plain ascii, s[i] indexes bytes in constant time
+ObjString* str_code_point(ObjString* str, size_t index);
+// fills the immortal single byte and small integer string caches
+void init_str_caches();
+// interned string with the characters of the rope
+ObjString* flatten_rope(ObjRope* rope);
 ObjArray* build_array(int64_t len, Value val);
 ObjArray* fill_array(int64_t len, Value* values);
 ObjFunc* new_func();
@@ -150,8 +194,6 @@ ObjInstance* new_instance(ObjClass* klass);
 ObjBoundMethod* new_bound_method(Value reciever, Obj* method);
 ObjString* obj_to_str(Value value);
 
-#ifdef DEBUG_LOG_GC
 const char* get_obj_type_name(ObjType type);
-#endif
 
 #endif
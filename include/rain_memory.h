@@ -18,14 +18,30 @@
 
 #define FREE(type, ptr) reallocate(ptr, sizeof(type), 0)
 
+// old space copy of a promoted nursery object
+#define FORWARDED_TO(obj) \
+    (*(Obj**)((Obj*)(obj) + 1))
+
 // resize a section of allocated memory
 void* reallocate(void* ptr, size_t old_size, size_t new_size);
 
+// allocates an object in the old space
+Obj* old_allocate(size_t size);
+
+// bump allocates from the nursery, NULL if the object does not fit
+void* nursery_allocate(size_t size);
+
+// records an old object which may reference the nursery
+void remember_obj(Obj* obj);
+
 // marks a value as being active
 void mark_obj(Obj* obj);
 
-// performs garbage collection
-void collect_garbage();
+// empties the nursery by promoting its survivors to the old space
+void minor_collect();
+
+// performs garbage collection, false if the heap is still over gc_config.max_heap
+bool collect_garbage();
 
 // frees all objects
 void free_objs();
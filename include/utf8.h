@@ -9,4 +9,8 @@
 // if len is not 0, is the maximum number of chars that can be consumed
 wchar_t decode_utf8_char(const char* letter, uint8_t* char_consumed, size_t len);
 
+// number of bytes in the character at letter, 1 for a byte which does not start valid utf-8
+// len is the number of bytes left in the string and must not be 0
+uint8_t utf8_char_len(const char* letter, size_t len);
+
 #endif
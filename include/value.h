@@ -2,11 +2,57 @@
 #define RAIN_VALUE_H
 
 #include <common.h>
+#include <string.h>
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjArray ObjArray;
 
+typedef enum {
+    OBJ_STRING,
+    OBJ_ARRAY,
+    OBJ_FUNC,
+    OBJ_NATIVE,
+    OBJ_CLOSURE,
+    OBJ_UPVALUE,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+    OBJ_BOUND_METHOD,
+    OBJ_ROPE,
+#ifdef NAN_BOXING
+    OBJ_INT,
+#endif
+} ObjType;
+
+#ifdef NAN_BOXING
+#define NUM_OBJ_TYPES (OBJ_INT + 1)
+#else
+#define NUM_OBJ_TYPES (OBJ_ROPE + 1)
+#endif
+
+/* Object header
+ * A single word, objects are enumerated through the heap pages instead of a list
+ * a promoted nursery object is marked forwarded and its first word after the
+ * header points to the old space copy
+ * marked keeps a byte of its own as the parallel markers exchange it atomically,
+ * the other flags share one byte and the padding keeps the payload word aligned
+ */
+struct Obj {
+    struct
+    {
+        uint8_t type;
+        bool marked;
+        bool immortal : 1;
+        bool defined : 1;
+        bool remembered : 1;
+        bool forwarded : 1;
+        uint8_t padding[5];
+    } type_fields;
+};
+
+_Static_assert(sizeof(Obj) == 8, "the object header must be a single word");
+
+
 typedef enum {
     VAL_BOOL,
     VAL_NULL,
@@ -15,6 +61,36 @@ typedef enum {
     VAL_OBJ,
 } ValueType;
 
+#ifdef NAN_BOXING
+
+/*
+ * With NAN_BOXING a value is a single 64 bit word. Anything that is not a
+ * quiet NaN with the QNAN bits below set is a plain double. The remaining
+ * values are tagged by their top 16 bits:
+ *   0x7ffc - singletons (null, false, true) in the low bits
+ *   0x7ffd - 48 bit signed int payload
+ *   0xfffc - 48 bit object pointer
+ * Ints which don't fit in 48 bits are boxed in an ObjInt on the heap so the
+ * language keeps full 64 bit int semantics, see box_int.
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT         ((uint64_t)0x8000000000000000)
+#define QNAN             ((uint64_t)0x7ffc000000000000)
+#define INT_TAG          ((uint64_t)0x7ffd000000000000)
+#define OBJ_TAG          (SIGN_BIT | QNAN)
+#define PAYLOAD_MASK     ((uint64_t)0x0000ffffffffffff)
+#define CANONICAL_NAN    ((uint64_t)0x7ff8000000000000)
+
+#define TAG_NULL         1
+#define TAG_FALSE        2
+#define TAG_TRUE         3
+
+#define SMALL_INT_MIN    (-((int64_t)1 << 47))
+#define SMALL_INT_MAX    (((int64_t)1 << 47) - 1)
+
+#else
+
 typedef struct {
     ValueType type;
     union {
@@ -25,6 +101,8 @@ typedef struct {
     } as;
 } Value;
 
+#endif
+
 typedef struct
 {
     size_t capacity;
@@ -34,6 +112,102 @@ typedef struct
 
 bool values_eql(Value a, Value b);
 
+#ifdef NAN_BOXING
+
+// boxes an int which doesn't fit in the 48 bit payload
+Value box_int(int64_t value);
+// reads the int out of a boxed int
+int64_t unbox_int(Value value);
+
+static inline Value value_from_int(int64_t value)
+{
+    if(value >= SMALL_INT_MIN && value <= SMALL_INT_MAX)
+    {
+        return INT_TAG | ((uint64_t)value & PAYLOAD_MASK);
+    }
+    return box_int(value);
+}
+
+static inline Value value_from_float(double value)
+{
+    Value res;
+    memcpy(&res, &value, sizeof(double));
+    // keep NaNs produced by arithmetic out of the tagged space
+    if((res & QNAN) == QNAN)
+    {
+        return CANONICAL_NAN;
+    }
+    return res;
+}
+
+static inline double value_as_float(Value value)
+{
+    double res;
+    memcpy(&res, &value, sizeof(double));
+    return res;
+}
+
+#define IS_SMALL_INT(value) (((value) & ~PAYLOAD_MASK) == INT_TAG)
+
+static inline int64_t value_as_int(Value value)
+{
+    if(IS_SMALL_INT(value))
+    {
+        // sign extend the 48 bit payload
+        return (int64_t)(value << 16) >> 16;
+    }
+    return unbox_int(value);
+}
+
+#define BOOL_VAL(value)  ((value) ? (QNAN | TAG_TRUE) : (QNAN | TAG_FALSE))
+#define INT_VAL(value)   value_from_int((int64_t)(value))
+#define FLOAT_VAL(value) value_from_float(value)
+#define OBJ_VAL(value)   (OBJ_TAG | (uint64_t)(uintptr_t)(value))
+#define NULL_VAL         (QNAN | TAG_NULL)
+
+#define AS_BOOL(value)   ((value) == (QNAN | TAG_TRUE))
+#define AS_INT(value)    value_as_int(value)
+#define AS_FLOAT(value)  value_as_float(value)
+#define AS_OBJ(value)    ((Obj*)(uintptr_t)((value) & PAYLOAD_MASK))
+
+#define IS_BOOL(value)   (((value) | 1) == (QNAN | TAG_TRUE))
+#define IS_INT(value)    value_is_int(value)
+#define IS_FLOAT(value)  (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)    (((value) & OBJ_TAG) == OBJ_TAG)
+#define IS_NULL(value)   ((value) == NULL_VAL)
+
+// checks if an object value is a boxed int, inline as IS_INT guards every arithmetic op
+static inline bool is_boxed_int(Value value)
+{
+    return IS_OBJ(value) && AS_OBJ(value)->type_fields.type == OBJ_INT;
+}
+
+static inline bool value_is_int(Value value)
+{
+    return IS_SMALL_INT(value) || is_boxed_int(value);
+}
+
+static inline ValueType value_type(Value value)
+{
+    if(IS_FLOAT(value))
+    {
+        return VAL_FLOAT;
+    }
+    if(IS_SMALL_INT(value))
+    {
+        return VAL_INT;
+    }
+    if(IS_OBJ(value))
+    {
+        return is_boxed_int(value) ? VAL_INT : VAL_OBJ;
+    }
+    return IS_NULL(value) ? VAL_NULL : VAL_BOOL;
+}
+
+#define VALUE_TYPE(value) value_type(value)
+
+#else
+
 #define BOOL_VAL(value)  ((Value){.type = VAL_BOOL, {.bool_data = value}})
 #define INT_VAL(value)   ((Value){.type = VAL_INT,  {.int_data = value}})
 #define FLOAT_VAL(value) ((Value){.type = VAL_FLOAT, {.float_data = value}})
@@ -48,15 +222,18 @@ bool values_eql(Value a, Value b);
 #define IS_BOOL(value)   ((value).type == VAL_BOOL)
 #define IS_INT(value)    ((value).type == VAL_INT)
 #define IS_FLOAT(value)  ((value).type == VAL_FLOAT)
-inline bool IS_NUMBER(Value value)
+#define IS_OBJ(value)    ((value).type == VAL_OBJ)
+#define IS_NULL(value)   ((value).type == VAL_NULL)
+
+#define VALUE_TYPE(value) ((value).type)
+
+#endif
+
+static inline bool IS_NUMBER(Value value)
 {
     return IS_INT(value) || IS_FLOAT(value);
 }
 
-#define IS_OBJ(value)    ((value).type == VAL_OBJ)
-
-#define IS_NULL(value)   ((value).type == VAL_NULL)
-
 // initialises value array
 void init_value_array(ValueArray* array);
 // write a value to the value array
@@ -5,28 +5,133 @@
 #include <value.h>
 #include <object.h>
 #include <hash_table.h>
+#include <rain_memory.h>
+#include <heap.h>
 
-#define STACK_MAX (32768 / sizeof(Value))
+// slots the stack starts with, it doubles whenever a call needs more
+#define STACK_INITIAL_SIZE 256
+// default bound on the stack's size in bytes, which bounds the depth of recursion
+#define STACK_MAX_BYTES (64 * 1024 * 1024)
+// no instruction pushes more than this many values, bounding a function's stack use by its code size
+#define STACK_SLOTS_PER_BYTE 3
+// call frames the frame array starts with, it doubles like the stack
+#define FRAMES_INITIAL_SIZE 64
+#define NURSERY_SIZE (1024 * 1024)
+// gray objects processed by each incremental marking slice
+#define GC_MARK_BUDGET 256
+// objects visited by each lazy sweeping slice
+#define GC_SWEEP_BUDGET 1024
+#ifdef PARALLEL_MARK
+#define GC_MAX_THREADS 64
+#else
+// without parallel marking the old space is only marked on the vm's thread
+#define GC_MAX_THREADS 1
+#endif
+// the heap may grow to this multiple of the bytes surviving a collection
+#define GC_GROWTH_FACTOR 2.0
+#define GC_INITIAL_THRESHOLD 0x1000
+// decimal strings of the integers 0 to SMALL_INT_STRS - 1 are made once at startup
+#define SMALL_INT_STRS 1024
+
+typedef enum {
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP,
+} GCPhase;
+
+// collector settings, changed at runtime through configure_gc or the gc_tune native
+typedef struct {
+    double growth_factor;
+    // bytes allocated before the first major collection
+    size_t initial_threshold;
+    // 0 for no limit, going over it after a full collection is a runtime error
+    size_t max_heap;
+    size_t mark_budget;
+    size_t sweep_budget;
+    // threads used to mark the old space, 1 marks incrementally on the vm's thread
+    size_t threads;
+} GCConfig;
+
+// running totals of the collector, read by the host or through the gc_stat native
+typedef struct {
+    // completed major collections
+    size_t collections;
+    size_t minor_collections;
+    size_t bytes_freed;
+    // safe points which did collection work and the time spent in them
+    size_t pauses;
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+    size_t peak_heap;
+    // old space objects left by the last major collection
+    size_t live_objects[NUM_OBJ_TYPES];
+} GCStats;
+
+/* Call frame
+ * What a return restores in the caller, a function's own slots start at its stack_base
+ * with its callee just below them
+ */
+typedef struct {
+    Inst* ret;
+    // offset of the caller's stack_base from vm.stack, as the stack may be reallocated
+    size_t base;
+    // the caller's vm.closure
+    ObjClosure* closure;
+} CallFrame;
 
 typedef struct {
     Chunk* chunk;
-    inst_type* ip;
-    Value stack[STACK_MAX];
+    Inst* ip;
+    // grown by reallocation, so frames hold offsets into it
+    Value* stack;
+    size_t stack_capacity;
+    size_t stack_max;
     Value* stack_base;
     Value* stack_top;
-    Value* call_base;
+    /* Closure of the running function, NULL for functions without upvalues and the script
+     * Functions and closures are made by the compiler in the old space and stay in the
+     * chunk's constants, so frames can hold them without rooting and they never move
+     */
+    ObjClosure* closure;
+    CallFrame* frames;
+    size_t frame_count;
+    size_t frame_capacity;
     Value* searched;
     HashTable strings;
-    Obj* objects;
+    // immortal strings shared by every single byte result and small integer conversion
+    ObjString* char_strs[256];
+    ObjString* int_strs[SMALL_INT_STRS];
+    Heap heap;
     ObjUpvalue* open_upvalues;
     size_t gray_size;
     size_t gray_capacity;
     Obj** gray_stack;
     bool running;
     bool mark_bit;
-    bool gc;
+    bool gc_pending;
+    bool nursery_full;
+    GCPhase gc_phase;
+    GCConfig gc_config;
+    GCStats gc_stats;
+    HeapCursor sweep_cursor;
+    uint8_t* nursery;
+    uint8_t* nursery_top;
+    uint8_t* nursery_end;
+    size_t remembered_size;
+    size_t remembered_capacity;
+    Obj** remembered;
+    size_t promoted_size;
+    size_t promoted_capacity;
+    Obj** promoted;
     size_t bytes_allocated;
     size_t next_gc;
+    // debugging output chosen at startup with --trace, --dump-bytecode and --gc-log
+    bool trace_execution;
+    bool print_code;
+    bool log_gc;
+    // --count-dispatch counts the instructions run, for comparing instruction sets
+    bool count_dispatch;
+    size_t dispatch_count;
 } VM;
 
 typedef enum {
@@ -37,10 +142,44 @@ typedef enum {
 
 extern VM vm;
 
+// objects made while sweeping are black so the sweeper keeps them
+#define ALLOC_MARK() \
+    (vm.gc_phase == GC_SWEEP ? vm.mark_bit : !vm.mark_bit)
+
+// objects in the nursery have not survived a collection yet
+#define IS_YOUNG(obj) \
+    ((uint8_t*)(obj) >= vm.nursery && (uint8_t*)(obj) < vm.nursery_end)
+
+/* Must follow every store of a value into an object
+ * old objects pointing into the nursery are remembered for the next minor collection
+ * while marking, stored old objects are shaded so no black object points to a white one
+ */
+#define WRITE_BARRIER(obj, value) \
+    do \
+    { \
+        if(IS_OBJ(value)) \
+        { \
+            Obj* target = AS_OBJ(value); \
+            if(IS_YOUNG(target)) \
+            { \
+                if(!IS_YOUNG(obj) && !((Obj*)(obj))->type_fields.remembered) \
+                { \
+                    remember_obj((Obj*)(obj)); \
+                } \
+            } \
+            else if(vm.gc_phase == GC_MARK) \
+            { \
+                mark_obj(target); \
+            } \
+        } \
+    } while(false)
+
 // initialises virtual machine
 void init_vm();
 // interprets a chunk
 InterpretResult interpret(const char* src, HashTable* global_names, Chunk* main_chunk);
+// applies new collector settings, the initial threshold only matters before the first collection
+void configure_gc(const GCConfig* config);
 // push value onto stack
 void push(Value value);
 // pop value from stack
@@ -1,5 +1,6 @@
 #include <chunk.h>
 #include <rain_memory.h>
+#include <object.h>
 
 void init_chunk(Chunk* chunk)
 {
@@ -8,6 +9,11 @@ void init_chunk(Chunk* chunk)
     chunk->size = 0;
     chunk->entry = 0;
     chunk->code = NULL;
+    chunk->insts_size = 0;
+    chunk->insts_capacity = 0;
+    chunk->insts = NULL;
+    chunk->attr_caches_size = 0;
+    chunk->attr_caches = NULL;
     init_line_array(&chunk->line_encoding);
     init_value_array(&chunk->consts);
     init_value_array(&chunk->globals);
@@ -151,6 +157,29 @@ void write_chunk_attr_set_this(Chunk* chunk, size_t const_index, size_t line)
     write_chunk_const_impl(chunk, const_index, line, OP_ATTR_SET_THIS_BYTE, OP_ATTR_SET_THIS_SHORT, OP_ATTR_SET_THIS_WORD, OP_ATTR_SET_THIS_LONG);
 }
 
+void write_chunk_call(Chunk* chunk, uint8_t args, size_t line)
+{
+    write_chunk(chunk, OP_CALL, line);
+    write_chunk(chunk, args, line);
+}
+
+void write_chunk_invoke(Chunk* chunk, size_t const_index, uint8_t args, size_t line)
+{
+    write_chunk_const_impl(chunk, const_index, line, OP_INVOKE_BYTE, OP_INVOKE_SHORT, OP_INVOKE_WORD, OP_INVOKE_LONG);
+    write_chunk(chunk, args, line);
+}
+
+void write_chunk_invoke_this(Chunk* chunk, size_t const_index, uint8_t args, size_t line)
+{
+    write_chunk_const_impl(chunk, const_index, line, OP_INVOKE_THIS_BYTE, OP_INVOKE_THIS_SHORT, OP_INVOKE_THIS_WORD, OP_INVOKE_THIS_LONG);
+    write_chunk(chunk, args, line);
+}
+
+void write_chunk_build_string(Chunk* chunk, size_t count, size_t line)
+{
+    write_chunk_const_impl(chunk, count, line, OP_BUILD_STRING_BYTE, OP_BUILD_STRING_SHORT, OP_BUILD_STRING_WORD, OP_BUILD_STRING_LONG);
+}
+
 size_t read_chunk_const(inst_type* inst, size_t* offset, size_t off_size)
 {
     size_t inst_size = sizeof(inst_type);
@@ -191,9 +220,348 @@ void copy_chunk_context(Chunk* from, Chunk* to)
     }
 }
 
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_INDEX,
+    OPERAND_ATTR,
+    OPERAND_INVOKE,
+    OPERAND_JUMP,
+    OPERAND_JUMP_BACK,
+} OperandType;
+
+// families of instructions with BYTE, SHORT, WORD and LONG sized operands
+static const struct
+{
+    inst_type base;
+    OperandType type;
+} families[] = {
+    {OP_CONST_BYTE, OPERAND_INDEX},
+    {OP_GET_GLOBAL_BYTE, OPERAND_INDEX},
+    {OP_SET_GLOBAL_BYTE, OPERAND_INDEX},
+    {OP_GET_UPVALUE_BYTE, OPERAND_INDEX},
+    {OP_SET_UPVALUE_BYTE, OPERAND_INDEX},
+    {OP_GET_LOCAL_BYTE, OPERAND_INDEX},
+    {OP_SET_LOCAL_BYTE, OPERAND_INDEX},
+    {OP_JUMP_IF_FALSE_BYTE, OPERAND_JUMP},
+    {OP_JUMP_IF_TRUE_BYTE, OPERAND_JUMP},
+    {OP_JUMP_BYTE, OPERAND_JUMP},
+    {OP_JUMP_BACK_BYTE, OPERAND_JUMP_BACK},
+    {OP_CLOSURE_BYTE, OPERAND_INDEX},
+    {OP_ATTR_BYTE, OPERAND_ATTR},
+    {OP_ATTR_GET_BYTE, OPERAND_INDEX},
+    {OP_ATTR_PEEK_BYTE, OPERAND_INDEX},
+    {OP_ATTR_SET_BYTE, OPERAND_INDEX},
+    {OP_ATTR_GET_THIS_BYTE, OPERAND_INDEX},
+    {OP_ATTR_PEEK_THIS_BYTE, OPERAND_INDEX},
+    {OP_ATTR_SET_THIS_BYTE, OPERAND_INDEX},
+    {OP_INVOKE_BYTE, OPERAND_INVOKE},
+    {OP_INVOKE_THIS_BYTE, OPERAND_INVOKE},
+    // the operand is a piece count, read the same way as an index
+    {OP_BUILD_STRING_BYTE, OPERAND_INDEX},
+};
+
+static void write_inst(Chunk* chunk, Inst inst)
+{
+    if(chunk->insts_capacity < chunk->insts_size + 1)
+    {
+        size_t next_cap = GROW_CAPACITY(chunk->insts_capacity);
+        chunk->insts = GROW_ARRAY(Inst, chunk->insts, chunk->insts_capacity, next_cap);
+        chunk->insts_capacity = next_cap;
+    }
+    chunk->insts[chunk->insts_size] = inst;
+    chunk->insts_size++;
+}
+
+static size_t read_jump_len(inst_type* code, size_t off_size)
+{
+    uint8_t* data = (uint8_t*)code;
+    size_t len = 0;
+    for(size_t i = off_size; i > 0; i--)
+    {
+        len |= ((size_t)data[(i - 1)] << ((off_size - i) * 8));
+    }
+    return len;
+}
+
+static bool is_operand_inst(Inst* inst)
+{
+    return inst->op == OP_CONST || inst->op == OP_GET_GLOBAL;
+}
+
+static bool jumps_to_pop(Chunk* chunk, Inst* jump)
+{
+    return jump->op == OP_JUMP_IF_FALSE && jump->arg < chunk->insts_size && chunk->insts[jump->arg].op == OP_POP;
+}
+
+// a local or constant read by a register op, false if it is neither or its index does not fit
+static bool reg_source(Inst* inst, size_t* src)
+{
+    if(inst->op == OP_GET_LOCAL && inst->arg <= REG_MAX)
+    {
+        *src = inst->arg;
+        return true;
+    }
+    if(inst->op == OP_CONST && inst->arg <= REG_MAX)
+    {
+        *src = inst->arg | REG_CONST;
+        return true;
+    }
+    return false;
+}
+
+static inst_type reg_op(inst_type op)
+{
+    switch(op)
+    {
+        case OP_ADD: return OP_REG_ADD;
+        case OP_SUB: return OP_REG_SUB;
+        case OP_MUL: return OP_REG_MUL;
+        case OP_EQL: return OP_REG_EQL;
+        case OP_LESS: return OP_REG_LESS;
+        case OP_GREATER: return OP_REG_GREATER;
+        default: return OP_EXIT;
+    }
+}
+
+/* Register ops
+ * Two operand pushes and a binary op, a = b + c or the b + c inside an expression, become one
+ * three operand superinstruction reading locals and constants in place and writing a local or the stack
+ * The fallback pushes the first operand and continues with the second
+*/
+static void fuse_register_op(Inst* inst, size_t left)
+{
+    size_t src1;
+    size_t src2;
+    inst_type op = left >= 3 ? reg_op(inst[2].op) : OP_EXIT;
+    if(op == OP_EXIT || !reg_source(&inst[0], &src1) || !reg_source(&inst[1], &src2))
+    {
+        return;
+    }
+    size_t dst = REG_PUSH;
+    if(left >= 5 && inst[3].op == OP_SET_LOCAL && inst[4].op == OP_POP && inst[3].arg <= REG_MAX)
+    {
+        dst = inst[3].arg;
+    }
+    inst->op = op;
+    inst->arg = REG_PACK(dst, src1, src2);
+}
+
+/* Superinstructions
+ * Common sequences emitted by the compiler are fused by rewriting the op of their first instruction
+ * The rest of the sequence is left in place, the fused handler reads its operands from it and skips it
+ * On a type miss the fused handler runs the first instruction as normal and continues into the rest,
+ * so jumps into the middle of a sequence still land on valid instructions
+*/
+static void fuse_insts(Chunk* chunk)
+{
+    for(size_t i = 0; i < chunk->insts_size; i++)
+    {
+        Inst* inst = &chunk->insts[i];
+        size_t left = chunk->insts_size - i;
+        switch(inst->op)
+        {
+            case OP_GET_LOCAL:
+            case OP_GET_GLOBAL:
+            {
+                inst_type set_op = inst->op == OP_GET_LOCAL ? OP_SET_LOCAL : OP_SET_GLOBAL;
+                // x++, x += const
+                if(left >= 5 && inst[1].op == OP_CONST && inst[2].op == OP_ADD &&
+                    inst[3].op == set_op && inst[3].arg == inst->arg && inst[4].op == OP_POP)
+                {
+                    inst->op = inst->op == OP_GET_LOCAL ? OP_INC_LOCAL : OP_INC_GLOBAL;
+                }
+                else if(inst->op != OP_GET_LOCAL)
+                {
+                    break;
+                }
+                // local < const or global, loop conditions
+                else if(left >= 5 && is_operand_inst(&inst[1]) && inst[2].op == OP_LESS &&
+                    jumps_to_pop(chunk, &inst[3]) && inst[4].op == OP_POP)
+                {
+                    inst->op = OP_LOCAL_LESS_CONST_JUMP_IF_FALSE;
+                }
+                // local <= const or global, compiled as !(a > b)
+                else if(left >= 6 && is_operand_inst(&inst[1]) && inst[2].op == OP_GREATER &&
+                    inst[3].op == OP_NOT && jumps_to_pop(chunk, &inst[4]) && inst[5].op == OP_POP)
+                {
+                    inst->op = OP_LOCAL_LESS_EQL_CONST_JUMP_IF_FALSE;
+                }
+                else
+                {
+                    fuse_register_op(inst, left);
+                }
+                break;
+            }
+            case OP_CONST:
+            {
+                fuse_register_op(inst, left);
+                break;
+            }
+            case OP_SET_LOCAL:
+            case OP_SET_GLOBAL:
+            {
+                if(left >= 2 && inst[1].op == OP_POP)
+                {
+                    inst->op = inst->op == OP_SET_LOCAL ? OP_SET_LOCAL_POP : OP_SET_GLOBAL_POP;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+}
+
+static void alloc_attr_caches(Chunk* chunk)
+{
+    size_t caches = 0;
+    for(size_t i = 0; i < chunk->insts_size; i++)
+    {
+        switch(chunk->insts[i].op)
+        {
+            case OP_ATTR_GET:
+            case OP_ATTR_PEEK:
+            case OP_ATTR_SET:
+            case OP_ATTR_GET_THIS:
+            case OP_ATTR_PEEK_THIS:
+            case OP_ATTR_SET_THIS:
+            case OP_INVOKE:
+            case OP_INVOKE_THIS:
+            {
+                chunk->insts[i].cache = (uint32_t)caches;
+                caches++;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+    FREE_ARRAY(AttrCache, chunk->attr_caches, chunk->attr_caches_size);
+    chunk->attr_caches = NULL;
+    chunk->attr_caches_size = caches;
+    if(caches == 0)
+    {
+        return;
+    }
+    chunk->attr_caches = ALLOCATE(AttrCache, caches);
+    memset(chunk->attr_caches, 0, sizeof(AttrCache) * caches);
+}
+
+void decode_chunk(Chunk* chunk)
+{
+    chunk->insts_size = 0;
+    for(size_t offset = 0; offset < chunk->size;)
+    {
+        Inst inst = {.op = chunk->code[offset], .arg = 0, .offset = offset, .scope = 0, .args = 0, .cache = 0};
+        OperandType type = OPERAND_NONE;
+        size_t off_size = 0;
+        for(size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++)
+        {
+            if(inst.op >= families[i].base && inst.op < families[i].base + 4)
+            {
+                off_size = (size_t)1 << (inst.op - families[i].base);
+                type = families[i].type;
+                inst.op = families[i].base;
+                break;
+            }
+        }
+        offset++;
+        switch(type)
+        {
+            case OPERAND_INDEX:
+            case OPERAND_ATTR:
+            case OPERAND_INVOKE:
+            {
+                size_t inc_offset = 0;
+                inst.arg = read_chunk_const(chunk->code + offset, &inc_offset, off_size);
+                offset += inc_offset;
+                if(type == OPERAND_ATTR)
+                {
+                    inst.scope = (uint8_t)chunk->code[offset];
+                    offset++;
+                }
+                else if(type == OPERAND_INVOKE)
+                {
+                    inst.args = (uint8_t)chunk->code[offset];
+                    offset++;
+                }
+                break;
+            }
+            case OPERAND_JUMP:
+            case OPERAND_JUMP_BACK:
+            {
+                size_t len = read_jump_len(chunk->code + offset, off_size);
+                offset += (off_size + sizeof(inst_type) - 1) / sizeof(inst_type);
+                // resolved into an instruction index once all instructions are known
+                inst.arg = type == OPERAND_JUMP ? offset + len : offset - len;
+                inst.op = type == OPERAND_JUMP_BACK ? OP_JUMP : inst.op;
+                break;
+            }
+            default:
+            {
+                if(inst.op == OP_CALL || inst.op == OP_TAIL_CALL)
+                {
+                    inst.args = (uint8_t)chunk->code[offset];
+                    offset++;
+                }
+                break;
+            }
+        }
+        write_inst(chunk, inst);
+    }
+    for(size_t i = 0; i < chunk->insts_size; i++)
+    {
+        Inst* inst = &chunk->insts[i];
+        if(inst->op == OP_JUMP || inst->op == OP_JUMP_IF_FALSE || inst->op == OP_JUMP_IF_TRUE)
+        {
+            inst->arg = get_inst_index(chunk, inst->arg);
+        }
+    }
+    fuse_insts(chunk);
+    alloc_attr_caches(chunk);
+    for(size_t i = 0; i < chunk->consts.size; i++)
+    {
+        Value value = chunk->consts.values[i];
+        if(IS_FUNC(value))
+        {
+            AS_FUNC(value)->entry = get_inst_index(chunk, AS_FUNC(value)->offset);
+        }
+        else if(IS_CLOSURE(value))
+        {
+            AS_CLOSURE(value)->func->entry = get_inst_index(chunk, AS_CLOSURE(value)->func->offset);
+        }
+    }
+}
+
+size_t get_inst_index(Chunk* chunk, size_t offset)
+{
+    size_t low = 0;
+    size_t high = chunk->insts_size;
+    while(low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if(chunk->insts[mid].offset < offset)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
 void free_chunk(Chunk* chunk)
 {
     FREE_ARRAY(inst_type, chunk->code, chunk->capacity);
+    FREE_ARRAY(Inst, chunk->insts, chunk->insts_capacity);
+    FREE_ARRAY(AttrCache, chunk->attr_caches, chunk->attr_caches_size);
     free_line_array(&chunk->line_encoding);
     free_value_array(&chunk->consts);
     free_value_array(&chunk->globals);
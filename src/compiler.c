@@ -9,10 +9,8 @@
 #include <rain_memory.h>
 #include <string.h>
 #include <natives.h>
-
-#ifdef DEBUG_PRINT_CODE
+#include <vm.h>
 #include <debug.h>
-#endif
 
 #ifdef DEBUG_TOKEN_TYPES
 
@@ -433,6 +431,8 @@ typedef struct {
     ObjFunc** func_table;
     size_t func_table_size;
     size_t func_table_capacity;
+    // bytecode offset just past the last OP_CALL, a call ending a returned expression is a tail call
+    size_t call_end;
     HashTable globals;
 } Compiler;
 
@@ -537,6 +537,7 @@ static void init_compiler(Compiler* compiler)
     compiler->func_table = NULL;
     compiler->func_table_capacity = 0;
     compiler->func_table_size = 0;
+    compiler->call_end = 0;
     init_hash_table(&compiler->globals);
     current = compiler;
 }
@@ -648,6 +649,27 @@ static void emit_attr_set_this(Value value)
     write_chunk_attr_set_this(current_chunk(), make_const(value), parser.previous.line);
 }
 
+static void emit_call(uint8_t args)
+{
+    write_chunk_call(current_chunk(), args, parser.previous.line);
+    current->call_end = current_chunk()->size;
+}
+
+static void emit_invoke(Value value, uint8_t args)
+{
+    write_chunk_invoke(current_chunk(), make_const(value), args, parser.previous.line);
+}
+
+static void emit_invoke_this(Value value, uint8_t args)
+{
+    write_chunk_invoke_this(current_chunk(), make_const(value), args, parser.previous.line);
+}
+
+static void emit_build_string(size_t count)
+{
+    write_chunk_build_string(current_chunk(), count, parser.previous.line);
+}
+
 static size_t reserve_const()
 {
     size_t index = make_const(NULL_VAL);
@@ -717,12 +739,10 @@ static void end_compiler()
     current->prev_scopes_size = 0;
     current->prev_scopes_capacity = 0;
     free_hash_table(&current->globals);
-#ifdef DEBUG_PRINT_CODE
-    if(!parser.had_error)
+    if(vm.print_code && !parser.had_error)
     {
         disassemble_chunk(current_chunk(), "code");
     }
-#endif
 }
 
 static void emit_get_var(Value value, bool upvalue, bool global)
@@ -749,7 +769,7 @@ static void emit_set_var(Value value, bool upvalue, bool global)
     }
     else if(upvalue)
     {
-        write_chunk_set_global_var(current_chunk(), (size_t)AS_INT(value), parser.previous.line);
+        write_chunk_set_upvalue(current_chunk(), (size_t)AS_INT(value), parser.previous.line);
     }
     else
     {
@@ -889,7 +909,8 @@ static void binary(bool assignable)
     }
 }
 
-static size_t push_arguments()
+// the count fits the one byte operand of OP_CALL, OP_TAIL_CALL, OP_INVOKE and OP_INVOKE_THIS
+static uint8_t push_arguments()
 {
     size_t args = 0;
     if(!check(TOKEN_RIGHT_PAREN))
@@ -897,18 +918,21 @@ static size_t push_arguments()
         do
         {
             expression();
+            if(args == UINT8_MAX)
+            {
+                error("Can't have more than 255 arguments");
+            }
             args++;
         } while(match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments");
-    return args;
+    return (uint8_t)args;
 }
 
 static void call(bool assignable)
 {
-    emit_inst(OP_PUSH_CALL_BASE);
-    size_t inputs = push_arguments();
-    emit_inst(OP_CALL);
+    uint8_t args = push_arguments();
+    emit_call(args);
 }
 
 
@@ -1100,10 +1124,12 @@ static void cast(bool assignable)
 }
 
 // TOKEN_STR_START ((TOKEN_INTERP_START expr TOKEN_INTERP_END) | TOKEN_STR_BODY)* TOKEN_STR_END
+// the pieces are left on the stack and joined by a single OP_BUILD_STRING
 static void string(bool assignable)
 {
     advance();
-    bool first = true;
+    size_t pieces = 0;
+    bool interpolated = false;
     while(parser.previous.type != TOKEN_STR_END && parser.previous.type != TOKEN_EOF)
     {
         switch(parser.previous.type)
@@ -1111,23 +1137,15 @@ static void string(bool assignable)
             case TOKEN_STR_BODY:
             {
                 emit_const(OBJ_VAL((Obj*)copy_str(parser.previous.start, parser.previous.len)));
-                if(!first)
-                {
-                    emit_inst(OP_ADD);
-                }
-                first = false;
+                pieces++;
                 break;
             }
             case TOKEN_INTERP_START:
             {
                 expression();
                 consume(TOKEN_INTERP_END, "Expect '}' after string interpolation");
-                emit_inst(OP_CAST_STR);
-                if(!first)
-                {
-                    emit_inst(OP_ADD);
-                }
-                first = false;
+                pieces++;
+                interpolated = true;
                 break;
             }
             default:
@@ -1138,6 +1156,18 @@ static void string(bool assignable)
         }
         advance();
     }
+    if(pieces == 0)
+    {
+        emit_const(OBJ_VAL((Obj*)copy_str("", 0)));
+    }
+    else if(pieces == 1 && interpolated)
+    {
+        emit_inst(OP_CAST_STR);
+    }
+    else if(pieces > 1)
+    {
+        emit_build_string(pieces);
+    }
 }
 
 static Value ident_constant(Token* name);
@@ -1313,6 +1343,12 @@ static void dot(bool assignable)
         EMIT_ASSIGNMENT(emit_attr_peek(OBJ_VAL((Obj*)name)));
         emit_attr_set(OBJ_VAL((Obj*)name));
     }
+    else if(match(TOKEN_LEFT_PAREN))
+    {
+        // method call, the reciever takes the place of the function until OP_INVOKE looks the method up
+        uint8_t args = push_arguments();
+        emit_invoke(OBJ_VAL((Obj*)name), args);
+    }
     else
     {
         emit_attr_get(OBJ_VAL((Obj*)name));
@@ -1342,6 +1378,11 @@ static void this_(bool assignable)
             EMIT_ASSIGNMENT(emit_attr_peek_this(OBJ_VAL((Obj*)name)));
             emit_attr_set_this(OBJ_VAL((Obj*)name));
         }
+        else if(match(TOKEN_LEFT_PAREN))
+        {
+            uint8_t args = push_arguments();
+            emit_invoke_this(OBJ_VAL((Obj*)name), args);
+        }
         else
         {
             emit_attr_get_this(OBJ_VAL((Obj*)name));
@@ -1458,11 +1499,12 @@ static void if_statement(bool in_func)
     begin_scope();
     block(in_func);
     end_scope();
+    // the condition is popped once on either path
+    size_t else_jump = emit_jump(OP_JUMP_BYTE);
+    patch_jump(then_jump);
+    emit_inst(OP_POP);
     if(match(TOKEN_ELSE))
     {
-        size_t else_jump = emit_jump(OP_JUMP_BYTE);
-        patch_jump(then_jump);
-        emit_inst(OP_POP);
         if(match(TOKEN_IF))
         {
             if_statement(in_func);
@@ -1474,13 +1516,8 @@ static void if_statement(bool in_func)
             block(in_func);
             end_scope();
         }
-        patch_jump(else_jump);
-    }
-    else
-    {
-        patch_jump(then_jump);
-        emit_inst(OP_POP);
     }
+    patch_jump(else_jump);
 }
 
 static void while_statement(bool in_func)
@@ -1494,8 +1531,8 @@ static void while_statement(bool in_func)
     emit_inst(OP_POP);
     begin_scope();
     block(in_func);
-    emit_loop(loop_start);
     end_scope();
+    emit_loop(loop_start);
     patch_jump(while_jump);
     emit_inst(OP_POP);
 }
@@ -1595,6 +1632,11 @@ static void return_statement(bool in_func)
     else
     {
         expression();
+        // nothing runs between the call and the return, so the call can reuse this function's frame
+        if(current->call_end == current_chunk()->size)
+        {
+            current_chunk()->code[current->call_end - 2] = OP_TAIL_CALL;
+        }
         emit_inst(OP_RETURN);
         consume(TOKEN_SEMICOLON, "Expect ';' after return value");
     }
@@ -1861,6 +1903,8 @@ static void function(bool method, Value val)
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body");
     block(true);
     emit_return();
+    // nested functions are counted too, widening jumps later only adds operand bytes
+    func->max_stack = STACK_SLOTS_PER_BYTE * (current_chunk()->size - offset);
     end_func_scope();
     patch_jump(from);
     if(current->scope.upvalues_size > 0)
@@ -2211,7 +2255,8 @@ static void resolve_jump_table(Chunk* obj_chunk, Chunk* res)
                         extra_bytes += current->jump_table[j].bytes;
                     }
                 }
-                jump_len = current->jump_table[jump_index].to - current->jump_table[jump_index].from - (current->jump_table[jump_index].bytes / sizeof(inst_type)) + extra_bytes;
+                // counted from the end of the operand, the opcode is the one slot the jump took before resolving
+                jump_len = current->jump_table[jump_index].to - current->jump_table[jump_index].from - 1 + extra_bytes;
             }
             else
             {
@@ -2266,6 +2311,10 @@ static void define_natives()
     define_native("print", print_native, 1);
     define_native("println", println_native, 1);
     define_native("input", input_native, 1);
+    define_native("gc_stat", gc_stat_native, 1);
+    define_native("gc_live", gc_live_native, 1);
+    define_native("gc_tune", gc_tune_native, 2);
+    define_native("code_point_at", code_point_at_native, 2);
 }
 
 bool compile(const char* src, Chunk* chunk, HashTable* global_names)
@@ -2278,13 +2327,7 @@ bool compile(const char* src, Chunk* chunk, HashTable* global_names)
     init_chunk(&obj_chunk);
     if(global_names)
     {
-        compiler.globals.entries = ALLOCATE(Entry, global_names->capacity);
-        for(size_t i = 0; i < global_names->capacity; i++)
-        {
-           compiler.globals.entries[i] = global_names->entries[i]; 
-        }
-        compiler.globals.count = global_names->count;
-        compiler.globals.capacity = global_names->capacity;
+        clone_hash_table(global_names, &compiler.globals);
         copy_chunk_context(chunk, &obj_chunk);
     }
     compiling_chunk = &obj_chunk;
@@ -2335,9 +2378,7 @@ bool compile(const char* src, Chunk* chunk, HashTable* global_names)
             free_hash_table(global_names);
             *global_names = compiler.globals;
         }
-        compiler.globals.entries = NULL;
-        compiler.globals.capacity = 0;
-        compiler.globals.count = 0;
+        init_hash_table(&compiler.globals);
     }
     free_chunk(&obj_chunk);
     end_compiler();
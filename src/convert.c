@@ -336,3 +336,27 @@ char* float_to_str(double num)
 {
     return d2s(num);
 }
+
+size_t int_to_dec_buffer(int64_t num, char* buffer)
+{
+    bool neg = num < 0 ? true : false;
+    uint64_t mag = neg ? -(uint64_t)num : (uint64_t)num;
+    size_t len = get_num_digits(mag, 10) + (neg ? 1 : 0);
+    if(neg)
+    {
+        buffer[0] = '-';
+    }
+    char* pos = buffer + (len - 1);
+    do
+    {
+        *pos = (mag % 10) + '0';
+        pos--;
+        mag /= 10;
+    } while(mag > 0);
+    return len;
+}
+
+size_t float_to_buffer(double num, char* buffer)
+{
+    return (size_t)d2s_buffered_n(num, buffer);
+}
@@ -39,6 +39,24 @@ static size_t attr_inst(const char* name, Chunk* chunk, size_t off_size, size_t
     return offset + inc_offset + 2;
 }
 
+static size_t invoke_inst(const char* name, Chunk* chunk, size_t off_size, size_t offset)
+{
+    size_t inc_offset = 0;
+    size_t constant = read_chunk_const(chunk->code + offset + 1, &inc_offset, off_size);
+    uint8_t args = (uint8_t)chunk->code[offset + inc_offset + 1];
+    printf("%-16s %4zu '", name, constant);
+    print_value(chunk->consts.values[constant]);
+    printf("' (%u args)\n", args);
+    return offset + inc_offset + 2;
+}
+
+static size_t byte_inst(const char* name, Chunk* chunk, size_t offset)
+{
+    uint8_t args = (uint8_t)chunk->code[offset + 1];
+    printf("%-16s %4u\n", name, args);
+    return offset + 2;
+}
+
 static size_t index_inst(const char* name, Chunk* chunk, size_t off_size, size_t offset)
 {
     size_t inc_offset = 0;
@@ -401,11 +419,11 @@ size_t disassemble_inst(Chunk* chunk, size_t offset)
         }
         case OP_CALL:
         {
-           return simple_inst("OP_CALL", offset); 
+           return byte_inst("OP_CALL", chunk, offset); 
         }
-        case OP_PUSH_CALL_BASE:
+        case OP_TAIL_CALL:
         {
-            return simple_inst("OP_PUSH_CALL_BASE", offset);
+            return byte_inst("OP_TAIL_CALL", chunk, offset);
         }
         case OP_CLOSURE_BYTE:
         {
@@ -539,6 +557,54 @@ size_t disassemble_inst(Chunk* chunk, size_t offset)
         {
            return const_inst("OP_ATTR_SET_THIS_LONG", chunk, 8, offset); 
         }
+        case OP_INVOKE_BYTE:
+        {
+           return invoke_inst("OP_INVOKE_BYTE", chunk, 1, offset); 
+        }
+        case OP_INVOKE_SHORT:
+        {
+           return invoke_inst("OP_INVOKE_SHORT", chunk, 2, offset); 
+        }
+        case OP_INVOKE_WORD:
+        {
+           return invoke_inst("OP_INVOKE_WORD", chunk, 4, offset); 
+        }
+        case OP_INVOKE_LONG:
+        {
+           return invoke_inst("OP_INVOKE_LONG", chunk, 8, offset); 
+        }
+        case OP_INVOKE_THIS_BYTE:
+        {
+           return invoke_inst("OP_INVOKE_THIS_BYTE", chunk, 1, offset); 
+        }
+        case OP_INVOKE_THIS_SHORT:
+        {
+           return invoke_inst("OP_INVOKE_THIS_SHORT", chunk, 2, offset); 
+        }
+        case OP_INVOKE_THIS_WORD:
+        {
+           return invoke_inst("OP_INVOKE_THIS_WORD", chunk, 4, offset); 
+        }
+        case OP_INVOKE_THIS_LONG:
+        {
+           return invoke_inst("OP_INVOKE_THIS_LONG", chunk, 8, offset); 
+        }
+        case OP_BUILD_STRING_BYTE:
+        {
+            return index_inst("OP_BUILD_STRING_BYTE", chunk, 1, offset);
+        }
+        case OP_BUILD_STRING_SHORT:
+        {
+            return index_inst("OP_BUILD_STRING_SHORT", chunk, 2, offset);
+        }
+        case OP_BUILD_STRING_WORD:
+        {
+            return index_inst("OP_BUILD_STRING_WORD", chunk, 4, offset);
+        }
+        case OP_BUILD_STRING_LONG:
+        {
+            return index_inst("OP_BUILD_STRING_LONG", chunk, 8, offset);
+        }
         case OP_EXIT:
         {
             return simple_inst("OP_EXIT", offset);
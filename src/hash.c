@@ -0,0 +1,147 @@
+#include <hash.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+/* String hashing
+ * wyhash: 8 byte words are folded together with 64x64 -> 128 bit multiplies, 48 bytes
+ * per round on long strings over three independent lanes. The seed is drawn once per
+ * process so scripts cannot precompute keys which collide in vm.strings
+ */
+static const uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ull,
+    0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull,
+};
+
+static uint64_t hash_seed;
+
+// a and b become the low and high words of a * b
+static inline void mum(uint64_t* a, uint64_t* b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t res = (__uint128_t)*a * *b;
+    *a = (uint64_t)res;
+    *b = (uint64_t)(res >> 64);
+#else
+    uint64_t ha = *a >> 32;
+    uint64_t hb = *b >> 32;
+    uint64_t la = (uint32_t)*a;
+    uint64_t lb = (uint32_t)*b;
+    uint64_t rh = ha * hb;
+    uint64_t rm0 = ha * lb;
+    uint64_t rm1 = hb * la;
+    uint64_t rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t read8(const uint8_t* bytes)
+{
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static inline uint64_t read4(const uint8_t* bytes)
+{
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+// 1 to 3 bytes
+static inline uint64_t read3(const uint8_t* bytes, size_t len)
+{
+    return ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[len >> 1] << 8) | bytes[len - 1];
+}
+
+void init_hash_seed()
+{
+    uint64_t seed = 0;
+#ifdef __unix__
+    if(getentropy(&seed, sizeof(seed)) != 0)
+    {
+        seed = 0;
+    }
+#endif
+    // without an entropy source the clock and stack address still differ between runs
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    seed ^= ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)&now;
+    hash_seed = mix(seed ^ secret[0], secret[1]);
+}
+
+uint32_t hash_bytes(const char* bytes, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)bytes;
+    uint64_t seed = hash_seed;
+    uint64_t a;
+    uint64_t b;
+    if(len <= 16)
+    {
+        if(len >= 4)
+        {
+            size_t mid = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + mid);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+        }
+        else if(len > 0)
+        {
+            a = read3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = 0;
+            b = 0;
+        }
+    }
+    else
+    {
+        size_t left = len;
+        if(left > 48)
+        {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do
+            {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                seed1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ seed1);
+                seed2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while(left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while(left > 16)
+        {
+            seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        // the last 16 bytes, overlapping what was already mixed
+        a = read8(p + left - 16);
+        b = read8(p + left - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    mum(&a, &b);
+    uint64_t hash = mix(a ^ secret[0] ^ len, b ^ secret[1]);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -4,105 +4,201 @@
 #include <string.h>
 #include <vm.h>
 
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// deleted slots count against the load too
+#define TABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
 #define NULL_VAR (VarValue){.scope = 0, .value = NULL_VAL}
 #define VAR_VALUE(scope, value) (VarValue){.scope = (scope), .value = (value)}
 
+// full slots hold the low 7 bits of the hash, free ones have the high bit set
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+#define HASH_TAG(hash) ((uint8_t)((hash) & 0x7F))
+#define HASH_GROUP(hash, capacity) \
+    (((size_t)(hash) >> 7) & ((capacity) - 1) & ~(size_t)(HASH_GROUP_SIZE - 1))
+
 void init_hash_table(HashTable* table)
 {
     table->count = 0;
+    table->deleted = 0;
     table->capacity = 0;
+    table->ctrl = NULL;
     table->entries = NULL;
 }
 
 void free_hash_table(HashTable* table)
 {
+    FREE_ARRAY(uint8_t, table->ctrl, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
     init_hash_table(table);
 }
 
-static inline size_t comp_next_index(size_t index, size_t* add_on, size_t len)
+// bit i is set when control byte i of the group equals tag
+static inline uint32_t match_group(const uint8_t* group, uint8_t tag)
 {
-    size_t next_index = (index + (*add_on * *add_on)) % len;
-    (*add_on)++;
-    return next_index;
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < HASH_GROUP_SIZE; i++)
+    {
+        if(group[i] == tag)
+        {
+            mask |= (uint32_t)1 << i;
+        }
+    }
+    return mask;
+#endif
 }
 
-static Entry* find_entry(Entry* entries, size_t len, ObjString* key)
+// bit i is set when slot i of the group is empty or deleted
+static inline uint32_t match_free(const uint8_t* group)
 {
-    size_t index = key->hash % len;
-    size_t add_on = 1;
-    Entry* tombstone = NULL;
-    for(;;)
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < HASH_GROUP_SIZE; i++)
     {
-        Entry* entry = entries + index;
-        if(entry->key == NULL)
+        if(group[i] & 0x80)
         {
-            if(IS_NULL(entry->var.value))
-            {
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else if(tombstone == NULL)
+            mask |= (uint32_t)1 << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static inline size_t lowest_bit(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctz(mask);
+#else
+    size_t bit = 0;
+    while(!(mask & 1))
+    {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/* Probing
+ * Groups are visited in triangular steps, which reaches every group of a power of two
+ * table, until one with an empty slot shows the key cannot be further along
+ */
+static Entry* find_entry(HashTable* table, ObjString* key)
+{
+    uint8_t tag = HASH_TAG(key->hash);
+    size_t pos = HASH_GROUP(key->hash, table->capacity);
+    for(size_t step = HASH_GROUP_SIZE;; step += HASH_GROUP_SIZE)
+    {
+        const uint8_t* group = table->ctrl + pos;
+        for(uint32_t match = match_group(group, tag); match != 0; match &= match - 1)
+        {
+            Entry* entry = table->entries + pos + lowest_bit(match);
+            if(entry->key == key)
             {
-                tombstone = entry;
+                return entry;
             }
         }
-        else if(entry->key == key)
+        if(match_group(group, CTRL_EMPTY) != 0)
         {
-            return entry;
+            return NULL;
         }
-        index = comp_next_index(index, &add_on, len);
+        pos = (pos + step) & (table->capacity - 1);
+    }
+}
+
+// first empty or deleted slot on the probe sequence of hash
+static size_t find_free_slot(uint8_t* ctrl, size_t capacity, uint32_t hash)
+{
+    size_t pos = HASH_GROUP(hash, capacity);
+    for(size_t step = HASH_GROUP_SIZE;; step += HASH_GROUP_SIZE)
+    {
+        uint32_t free_slots = match_free(ctrl + pos);
+        if(free_slots != 0)
+        {
+            return pos + lowest_bit(free_slots);
+        }
+        pos = (pos + step) & (capacity - 1);
     }
 }
 
 static void adjust_capacity(HashTable* table, size_t capacity)
 {
+    uint8_t* ctrl = ALLOCATE(uint8_t, capacity);
     Entry* entries = ALLOCATE(Entry, capacity);
+    memset(ctrl, CTRL_EMPTY, capacity);
     for(size_t i = 0; i < capacity; i++)
     {
         entries[i].key = NULL;
         entries[i].var = NULL_VAR;
     }
-    table->count = 0;
     for(size_t i = 0; i < table->capacity; i++)
     {
         Entry* entry = table->entries + i;
         if(entry->key != NULL)
         {
-            Entry* dest = find_entry(entries, capacity, entry->key);
-            dest->key = entry->key;
-            dest->var = entry->var;
-            table->count++;
+            size_t slot = find_free_slot(ctrl, capacity, entry->key->hash);
+            ctrl[slot] = HASH_TAG(entry->key->hash);
+            entries[slot] = *entry;
         }
     }
+    FREE_ARRAY(uint8_t, table->ctrl, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    table->ctrl = ctrl;
     table->entries = entries;
     table->capacity = capacity;
+    table->deleted = 0;
 }
 
 bool hash_table_insert(HashTable* table, ObjString* key, uint8_t scope, Value value)
 {
-    if(table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    if(table->count + table->deleted + 1 > TABLE_MAX_LOAD(table->capacity))
     {
-        size_t capacity = GROW_CAPACITY(table->capacity);
+        // a table filled mostly by deleted slots is rebuilt at the same size
+        size_t capacity = table->capacity;
+        if(capacity == 0)
+        {
+            capacity = HASH_GROUP_SIZE;
+        }
+        else if(table->count + 1 > TABLE_MAX_LOAD(capacity) / 2)
+        {
+            capacity *= 2;
+        }
         adjust_capacity(table, capacity);
     }
+    if(find_entry(table, key) != NULL)
+    {
+        return false;
+    }
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    bool new_key = entry->key == NULL;
-    if(new_key && IS_NULL(entry->var.value))
+    size_t slot = find_free_slot(table->ctrl, table->capacity, key->hash);
+    if(table->ctrl[slot] == CTRL_DELETED)
     {
-        table->count++;
-        entry->key = key;
-        entry->var = VAR_VALUE(scope, value);
+        table->deleted--;
     }
-    return new_key;
+    table->ctrl[slot] = HASH_TAG(key->hash);
+    table->entries[slot].key = key;
+    table->entries[slot].var = VAR_VALUE(scope, value);
+    table->count++;
+    return true;
 }
 
 bool hash_table_set(HashTable* table, ObjString* key, Value value)
 {
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if(entry->key == NULL || IS_VAR_CONST(entry->var.scope))
+    if(table->count == 0)
+    {
+        return false;
+    }
+    Entry* entry = find_entry(table, key);
+    if(entry == NULL || IS_VAR_CONST(entry->var.scope))
     {
         return false;
     }
@@ -116,8 +212,8 @@ bool hash_table_get(HashTable* table, ObjString* key, Value* value)
     {
         return false;
     }
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if(entry->key == NULL)
+    Entry* entry = find_entry(table, key);
+    if(entry == NULL)
     {
         return false;
     }
@@ -125,20 +221,48 @@ bool hash_table_get(HashTable* table, ObjString* key, Value* value)
     return true;
 }
 
+Entry* hash_table_get_entry(HashTable* table, ObjString* key)
+{
+    if(table->count == 0)
+    {
+        return NULL;
+    }
+    return find_entry(table, key);
+}
+
+/* A slot whose group still has an empty slot never ended a probe sequence
+ * as probing stops at such a group, so it can be made empty again
+ * otherwise it becomes deleted and keeps later keys reachable
+ */
+static void delete_entry(HashTable* table, Entry* entry)
+{
+    size_t slot = (size_t)(entry - table->entries);
+    if(match_group(table->ctrl + (slot & ~(size_t)(HASH_GROUP_SIZE - 1)), CTRL_EMPTY) != 0)
+    {
+        table->ctrl[slot] = CTRL_EMPTY;
+    }
+    else
+    {
+        table->ctrl[slot] = CTRL_DELETED;
+        table->deleted++;
+    }
+    entry->key = NULL;
+    entry->var = NULL_VAR;
+    table->count--;
+}
+
 bool hash_table_delete(HashTable* table, ObjString* key)
 {
     if(table->count == 0)
     {
         return false;
     }
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if(entry->key == NULL)
+    Entry* entry = find_entry(table, key);
+    if(entry == NULL)
     {
         return false;
     }
-    entry->key = NULL;
-    entry->var.value = BOOL_VAL(true);
-    entry->var.scope = 0;
+    delete_entry(table, entry);
     return true;
 }
 
@@ -154,47 +278,77 @@ void copy_hash_table(HashTable* from, HashTable* to)
     }
 }
 
+void clone_hash_table(HashTable* from, HashTable* to)
+{
+    to->ctrl = ALLOCATE(uint8_t, from->capacity);
+    to->entries = ALLOCATE(Entry, from->capacity);
+    memcpy(to->ctrl, from->ctrl, from->capacity);
+    memcpy(to->entries, from->entries, sizeof(Entry) * from->capacity);
+    to->count = from->count;
+    to->deleted = from->deleted;
+    to->capacity = from->capacity;
+}
+
 ObjString* hash_table_find_str(HashTable* table, const char* chars, size_t len, uint32_t hash)
 {
     if(table->count == 0)
     {
         return NULL;
     }
-    size_t add_on = 1;
-    uint32_t index = hash % table->capacity;
-    for(;;)
+    uint8_t tag = HASH_TAG(hash);
+    size_t pos = HASH_GROUP(hash, table->capacity);
+    for(size_t step = HASH_GROUP_SIZE;; step += HASH_GROUP_SIZE)
     {
-        Entry* entry = table->entries + index;
-        if(entry->key == NULL)
+        const uint8_t* group = table->ctrl + pos;
+        for(uint32_t match = match_group(group, tag); match != 0; match &= match - 1)
         {
-            if(IS_NULL(entry->var.value))
+            ObjString* key = table->entries[pos + lowest_bit(match)].key;
+            if(key->len == len && key->hash == hash && (len == 0 || memcmp(key->chars, chars, len) == 0))
             {
-                return NULL;
+                return key;
             }
         }
-        else if(entry->key->len == len && entry->key->hash == hash && memcmp(entry->key->chars, chars, len) == 0)
+        if(match_group(group, CTRL_EMPTY) != 0)
         {
-            return entry->key;
+            return NULL;
         }
-        index = comp_next_index(index, &add_on, table->capacity);
+        pos = (pos + step) & (table->capacity - 1);
     }
 }
 
-
 uint8_t hash_table_get_scope(HashTable* table, ObjString* key)
 {
     if(table->count == 0)
     {
         return 0;
     }
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if(entry->key == NULL)
+    Entry* entry = find_entry(table, key);
+    if(entry == NULL)
     {
         return 0;
     }
     return entry->var.scope + 1;
 }
 
+void hash_table_remove_young(HashTable* table)
+{
+    for(size_t i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &table->entries[i];
+        if(entry->key != NULL && IS_YOUNG(entry->key))
+        {
+            if(entry->key->obj.type_fields.forwarded)
+            {
+                entry->key = (ObjString*)FORWARDED_TO(entry->key);
+            }
+            else
+            {
+                delete_entry(table, entry);
+            }
+        }
+    }
+}
+
 void hash_table_remove_clear(HashTable* table)
 {
     for(size_t i = 0; i < table->capacity; i++)
@@ -202,7 +356,7 @@ void hash_table_remove_clear(HashTable* table)
         Entry* entry = &table->entries[i];
         if(entry->key != NULL && entry->key->obj.type_fields.marked != vm.mark_bit && !entry->key->obj.type_fields.immortal)
         {
-            hash_table_delete(table, entry->key);
+            delete_entry(table, entry);
         }
     }
 }
@@ -0,0 +1,248 @@
+#include <heap.h>
+#include <stdlib.h>
+
+// first slot of a page, kept aligned like the slots themselves
+#define PAGE_DATA_OFFSET \
+    ((sizeof(HeapPage) + HEAP_SLOT_ALIGN - 1) & ~(size_t)(HEAP_SLOT_ALIGN - 1))
+
+#define PAGE_OF(obj) \
+    ((HeapPage*)((uintptr_t)(obj) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1)))
+
+static size_t size_class(size_t size)
+{
+    return (size + HEAP_SLOT_ALIGN - 1) / HEAP_SLOT_ALIGN - 1;
+}
+
+static uint8_t* slot_at(HeapPage* page, size_t slot)
+{
+    return (uint8_t*)page + PAGE_DATA_OFFSET + slot * page->slot_size;
+}
+
+static size_t slot_of(HeapPage* page, Obj* obj)
+{
+    return (size_t)((uint8_t*)obj - slot_at(page, 0)) / page->slot_size;
+}
+
+void init_heap(Heap* heap)
+{
+    for(size_t i = 0; i < HEAP_SIZE_CLASSES; i++)
+    {
+        heap->pages[i] = NULL;
+        heap->avail[i] = NULL;
+    }
+    heap->large = NULL;
+    heap->num_pages = 0;
+}
+
+static HeapPage* new_page(Heap* heap, size_t cls)
+{
+    HeapPage* page = (HeapPage*)aligned_alloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE);
+    if(page == NULL)
+    {
+        exit(1);
+    }
+    page->slot_size = (cls + 1) * HEAP_SLOT_ALIGN;
+    page->num_slots = (HEAP_PAGE_SIZE - PAGE_DATA_OFFSET) / page->slot_size;
+    page->live = 0;
+    page->bump = 0;
+    page->free = NULL;
+    for(size_t i = 0; i < HEAP_PAGE_SLOTS / 64; i++)
+    {
+        page->used[i] = 0;
+    }
+    page->next = heap->pages[cls];
+    heap->pages[cls] = page;
+    page->avail = true;
+    page->next_avail = heap->avail[cls];
+    heap->avail[cls] = page;
+    heap->num_pages++;
+    return page;
+}
+
+static Obj* allocate_large(Heap* heap, size_t size)
+{
+    LargeObj* large = (LargeObj*)malloc(sizeof(LargeObj) + size);
+    if(large == NULL)
+    {
+        exit(1);
+    }
+    large->prev = NULL;
+    large->next = heap->large;
+    if(heap->large != NULL)
+    {
+        heap->large->prev = large;
+    }
+    heap->large = large;
+    return (Obj*)(large + 1);
+}
+
+Obj* heap_allocate(Heap* heap, size_t size)
+{
+    if(size > HEAP_MAX_SLOT)
+    {
+        return allocate_large(heap, size);
+    }
+    size_t cls = size_class(size);
+    HeapPage* page = heap->avail[cls];
+    while(page != NULL && page->free == NULL && page->bump == page->num_slots)
+    {
+        page->avail = false;
+        page = page->next_avail;
+        heap->avail[cls] = page;
+    }
+    if(page == NULL)
+    {
+        page = new_page(heap, cls);
+    }
+    Obj* obj;
+    if(page->free != NULL)
+    {
+        obj = (Obj*)page->free;
+        page->free = *(void**)obj;
+    }
+    else
+    {
+        obj = (Obj*)slot_at(page, page->bump);
+        page->bump++;
+    }
+    size_t slot = slot_of(page, obj);
+    page->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+    page->live++;
+    return obj;
+}
+
+void heap_free(Heap* heap, Obj* obj, size_t size)
+{
+    if(size > HEAP_MAX_SLOT)
+    {
+        LargeObj* large = (LargeObj*)obj - 1;
+        if(large->prev != NULL)
+        {
+            large->prev->next = large->next;
+        }
+        else
+        {
+            heap->large = large->next;
+        }
+        if(large->next != NULL)
+        {
+            large->next->prev = large->prev;
+        }
+        free(large);
+        return;
+    }
+    HeapPage* page = PAGE_OF(obj);
+    size_t slot = slot_of(page, obj);
+    page->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    page->live--;
+    *(void**)obj = page->free;
+    page->free = obj;
+    if(!page->avail)
+    {
+        size_t cls = size_class(page->slot_size);
+        page->avail = true;
+        page->next_avail = heap->avail[cls];
+        heap->avail[cls] = page;
+    }
+}
+
+void heap_cursor_init(Heap* heap, HeapCursor* cursor)
+{
+    cursor->size_class = 0;
+    cursor->page = heap->pages[0];
+    cursor->slot = 0;
+    cursor->large = heap->large;
+}
+
+Obj* heap_cursor_next(Heap* heap, HeapCursor* cursor)
+{
+    while(cursor->size_class < HEAP_SIZE_CLASSES)
+    {
+        while(cursor->page != NULL)
+        {
+            HeapPage* page = cursor->page;
+            while(cursor->slot < page->bump)
+            {
+                size_t slot = cursor->slot;
+                uint64_t word = page->used[slot / 64] >> (slot % 64);
+                if(word == 0)
+                {
+                    cursor->slot = (slot / 64 + 1) * 64;
+                    continue;
+                }
+                cursor->slot++;
+                if(word & 1)
+                {
+                    return (Obj*)slot_at(page, slot);
+                }
+            }
+            cursor->page = page->next;
+            cursor->slot = 0;
+        }
+        cursor->size_class++;
+        if(cursor->size_class < HEAP_SIZE_CLASSES)
+        {
+            cursor->page = heap->pages[cursor->size_class];
+        }
+    }
+    if(cursor->large != NULL)
+    {
+        LargeObj* large = cursor->large;
+        cursor->large = large->next;
+        return (Obj*)(large + 1);
+    }
+    return NULL;
+}
+
+void heap_release_empty_pages(Heap* heap)
+{
+    for(size_t cls = 0; cls < HEAP_SIZE_CLASSES; cls++)
+    {
+        HeapPage* page = heap->pages[cls];
+        heap->pages[cls] = NULL;
+        heap->avail[cls] = NULL;
+        while(page != NULL)
+        {
+            HeapPage* next = page->next;
+            if(page->live == 0)
+            {
+                free(page);
+                heap->num_pages--;
+            }
+            else
+            {
+                page->next = heap->pages[cls];
+                heap->pages[cls] = page;
+                page->avail = page->free != NULL || page->bump < page->num_slots;
+                if(page->avail)
+                {
+                    page->next_avail = heap->avail[cls];
+                    heap->avail[cls] = page;
+                }
+            }
+            page = next;
+        }
+    }
+}
+
+void free_heap(Heap* heap)
+{
+    for(size_t cls = 0; cls < HEAP_SIZE_CLASSES; cls++)
+    {
+        HeapPage* page = heap->pages[cls];
+        while(page != NULL)
+        {
+            HeapPage* next = page->next;
+            free(page);
+            page = next;
+        }
+    }
+    LargeObj* large = heap->large;
+    while(large != NULL)
+    {
+        LargeObj* next = large->next;
+        free(large);
+        large = next;
+    }
+    init_heap(heap);
+}
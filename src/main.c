@@ -152,22 +152,153 @@ static void run_file(const char* path)
     }
 }
 
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [--trace] [--dump-bytecode] [--gc-log] [--gc-threads n] [--gc-growth factor] [--gc-initial bytes] [--gc-max-heap bytes] [--stack-max bytes] [--count-dispatch] [path]\n", name);
+    exit(64);
+}
+
+// number of marking threads, 0 if text is not a valid count
+static size_t parse_gc_threads(const char* text)
+{
+    char* end;
+    long threads = strtol(text, &end, 10);
+    if(*text == 0 || *end != 0 || threads < 1 || threads > GC_MAX_THREADS)
+    {
+        return 0;
+    }
+    return (size_t)threads;
+}
+
+// byte count for a memory setting, false if text is not one
+static bool parse_bytes(const char* text, size_t* bytes)
+{
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if(*text < '0' || *text > '9' || *end != 0)
+    {
+        return false;
+    }
+    *bytes = (size_t)value;
+    return true;
+}
+
 int main(int argc, const char* argv[])
 {
     init_vm();
-    
-    if(argc == 1)
+
+    const char* env_threads = getenv("RAIN_GC_THREADS");
+    if(env_threads != NULL)
     {
-        repl();
+        size_t threads = parse_gc_threads(env_threads);
+        if(threads == 0)
+        {
+#ifdef PARALLEL_MARK
+            fprintf(stderr, "RAIN_GC_THREADS must be between 1 and %d\n", GC_MAX_THREADS);
+#else
+            fprintf(stderr, "RAIN_GC_THREADS must be 1, this build has no parallel marking\n");
+#endif
+            exit(64);
+        }
+        vm.gc_config.threads = threads;
+    }
+
+    const char* path = NULL;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--trace") == 0)
+        {
+            vm.trace_execution = true;
+        }
+        else if(strcmp(argv[i], "--dump-bytecode") == 0)
+        {
+            vm.print_code = true;
+        }
+        else if(strcmp(argv[i], "--gc-log") == 0)
+        {
+            vm.log_gc = true;
+        }
+        else if(strcmp(argv[i], "--gc-threads") == 0)
+        {
+            if(i + 1 >= argc || (vm.gc_config.threads = parse_gc_threads(argv[i + 1])) == 0)
+            {
+#ifdef PARALLEL_MARK
+                fprintf(stderr, "--gc-threads must be between 1 and %d\n", GC_MAX_THREADS);
+#else
+                fprintf(stderr, "--gc-threads must be 1, this build has no parallel marking\n");
+#endif
+                exit(64);
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], "--gc-growth") == 0)
+        {
+            char* end = NULL;
+            if(i + 1 < argc)
+            {
+                vm.gc_config.growth_factor = strtod(argv[i + 1], &end);
+            }
+            if(end == NULL || end == argv[i + 1] || *end != 0 || !(vm.gc_config.growth_factor >= 1.0))
+            {
+                fprintf(stderr, "--gc-growth must be a number of at least 1\n");
+                exit(64);
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], "--gc-initial") == 0)
+        {
+            if(i + 1 >= argc || !parse_bytes(argv[i + 1], &vm.gc_config.initial_threshold))
+            {
+                fprintf(stderr, "--gc-initial must be a byte count\n");
+                exit(64);
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], "--gc-max-heap") == 0)
+        {
+            if(i + 1 >= argc || !parse_bytes(argv[i + 1], &vm.gc_config.max_heap))
+            {
+                fprintf(stderr, "--gc-max-heap must be a byte count\n");
+                exit(64);
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], "--stack-max") == 0)
+        {
+            if(i + 1 >= argc || !parse_bytes(argv[i + 1], &vm.stack_max))
+            {
+                fprintf(stderr, "--stack-max must be a byte count\n");
+                exit(64);
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], "--count-dispatch") == 0)
+        {
+            vm.count_dispatch = true;
+        }
+        else if(argv[i][0] == '-' || path != NULL)
+        {
+            usage(argv[0]);
+        }
+        else
+        {
+            path = argv[i];
+        }
     }
-    else if(argc == 2)
+
+    configure_gc(&vm.gc_config);
+
+    if(path == NULL)
     {
-        run_file(argv[1]);
+        repl();
     }
     else
     {
-        fprintf(stderr, "Usage: %s [path]\n", argv[0]);
-        exit(64);
+        run_file(path);
+    }
+    if(vm.count_dispatch)
+    {
+        fprintf(stderr, "%zu instructions dispatched\n", vm.dispatch_count);
     }
 
     free_vm();
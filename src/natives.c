@@ -2,6 +2,8 @@
 #include <time.h>
 #include <stdio.h>
 #include <object.h>
+#include <string.h>
+#include <vm.h>
 
 Value time_native(Value* args)
 {
@@ -38,3 +40,161 @@ Value input_native(Value* args)
     }
     return OBJ_VAL((Obj*)take_str(input, len));
 }
+
+// collector statistic named by args[0], null for unknown names
+Value gc_stat_native(Value* args)
+{
+    if(!IS_STRING(args[0]))
+    {
+        return NULL_VAL;
+    }
+    const char* name = AS_STRING(args[0])->chars;
+    GCStats* stats = &vm.gc_stats;
+    if(strcmp(name, "collections") == 0)
+    {
+        return INT_VAL(stats->collections);
+    }
+    if(strcmp(name, "minor_collections") == 0)
+    {
+        return INT_VAL(stats->minor_collections);
+    }
+    if(strcmp(name, "bytes_freed") == 0)
+    {
+        return INT_VAL(stats->bytes_freed);
+    }
+    if(strcmp(name, "pauses") == 0)
+    {
+        return INT_VAL(stats->pauses);
+    }
+    if(strcmp(name, "pause_total_us") == 0)
+    {
+        return FLOAT_VAL(stats->pause_total_ns / 1000.0);
+    }
+    if(strcmp(name, "pause_max_us") == 0)
+    {
+        return FLOAT_VAL(stats->pause_max_ns / 1000.0);
+    }
+    if(strcmp(name, "peak_heap") == 0)
+    {
+        return INT_VAL(stats->peak_heap);
+    }
+    if(strcmp(name, "heap") == 0)
+    {
+        return INT_VAL(vm.bytes_allocated);
+    }
+    if(strcmp(name, "next_gc") == 0)
+    {
+        return INT_VAL(vm.next_gc);
+    }
+    return NULL_VAL;
+}
+
+// objects of the type named by args[0] left by the last major collection
+Value gc_live_native(Value* args)
+{
+    if(!IS_STRING(args[0]))
+    {
+        return NULL_VAL;
+    }
+    for(size_t type = 0; type < NUM_OBJ_TYPES; type++)
+    {
+        if(strcmp(AS_STRING(args[0])->chars, get_obj_type_name((ObjType)type)) == 0)
+        {
+            return INT_VAL(vm.gc_stats.live_objects[type]);
+        }
+    }
+    return NULL_VAL;
+}
+
+static bool is_count(Value value, int64_t min, int64_t max)
+{
+    return IS_INT(value) && AS_INT(value) >= min && AS_INT(value) <= max;
+}
+
+// sets collector setting args[0] to args[1] and returns its old value, null if either is invalid
+// threads above 1 are invalid in builds without PARALLEL_MARK
+Value gc_tune_native(Value* args)
+{
+    if(!IS_STRING(args[0]))
+    {
+        return NULL_VAL;
+    }
+    const char* name = AS_STRING(args[0])->chars;
+    Value value = args[1];
+    GCConfig config = vm.gc_config;
+    Value old;
+    if(strcmp(name, "growth_factor") == 0)
+    {
+        double factor = IS_INT(value) ? (double)AS_INT(value) : IS_FLOAT(value) ? AS_FLOAT(value) : 0;
+        // a heap is never scheduled to shrink below what just survived
+        if(!(factor >= 1.0))
+        {
+            return NULL_VAL;
+        }
+        old = FLOAT_VAL(config.growth_factor);
+        config.growth_factor = factor;
+    }
+    else if(strcmp(name, "initial_threshold") == 0)
+    {
+        if(!is_count(value, 0, INT64_MAX))
+        {
+            return NULL_VAL;
+        }
+        old = INT_VAL(config.initial_threshold);
+        config.initial_threshold = (size_t)AS_INT(value);
+    }
+    else if(strcmp(name, "max_heap") == 0)
+    {
+        if(!is_count(value, 0, INT64_MAX))
+        {
+            return NULL_VAL;
+        }
+        old = INT_VAL(config.max_heap);
+        config.max_heap = (size_t)AS_INT(value);
+    }
+    else if(strcmp(name, "mark_budget") == 0)
+    {
+        if(!is_count(value, 1, INT64_MAX))
+        {
+            return NULL_VAL;
+        }
+        old = INT_VAL(config.mark_budget);
+        config.mark_budget = (size_t)AS_INT(value);
+    }
+    else if(strcmp(name, "sweep_budget") == 0)
+    {
+        if(!is_count(value, 1, INT64_MAX))
+        {
+            return NULL_VAL;
+        }
+        old = INT_VAL(config.sweep_budget);
+        config.sweep_budget = (size_t)AS_INT(value);
+    }
+    else if(strcmp(name, "threads") == 0)
+    {
+        if(!is_count(value, 1, GC_MAX_THREADS))
+        {
+            return NULL_VAL;
+        }
+        old = INT_VAL(config.threads);
+        config.threads = (size_t)AS_INT(value);
+    }
+    else
+    {
+        return NULL_VAL;
+    }
+    configure_gc(&config);
+    return old;
+}
+
+// the character at code point index args[1] of string args[0], where s[i] is the byte at byte index i
+// null if either is invalid or the index is beyond the last character, linear in the index for non ascii strings
+Value code_point_at_native(Value* args)
+{
+    if(!IS_STRING(args[0]) || !IS_INT(args[1]) || AS_INT(args[1]) < 0)
+    {
+        return NULL_VAL;
+    }
+    ObjString* letter = str_code_point(AS_STRING(args[0]), (size_t)AS_INT(args[1]));
+    return letter == NULL ? NULL_VAL : OBJ_VAL((Obj*)letter);
+}
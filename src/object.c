@@ -1,9 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <rain_memory.h>
 #include <object.h>
 #include <value.h>
 #include <vm.h>
+#include <hash.h>
+#include <convert.h>
+#include <utf8.h>
 
 #define ALLOCATE_OBJ(type, obj_type) \
     (type*)allocate_obj(sizeof(type), obj_type)
@@ -11,41 +15,57 @@
     (ObjString*)allocate_obj(sizeof(ObjString) + (len), OBJ_STRING)
 #define ALLOCATE_CLOSURE(len) \
     (ObjClosure*)allocate_obj(sizeof(ObjClosure) + (len) * sizeof(UpvalueIndex), OBJ_CLOSURE)
+#define ALLOCATE_INSTANCE(len) \
+    (ObjInstance*)allocate_obj(sizeof(ObjInstance) + (len) * sizeof(Value), OBJ_INSTANCE)
 #define ALLOCATE_ARRAY(len) \
     (ObjArray*)allocate_obj(sizeof(ObjArray) + (len) * sizeof(Value), OBJ_ARRAY)
 
-static uint32_t hash_str(const char* str, size_t len)
+/* Objects made by a running program start in the nursery
+ * classes, large objects and anything that does not fit go straight to the old space
+ * old objects made while running are remembered as they may be filled with young values
+ */
+static Obj* allocate_obj(size_t size, ObjType type)
 {
-    uint32_t hash = 2166136261u;
-    for(size_t i = 0; i < len; i++)
+    Obj* obj = NULL;
+    if(vm.running && type != OBJ_CLASS)
     {
-        hash ^= (uint8_t)str[i];
-        hash *= 16777619;
+        obj = (Obj*)nursery_allocate(size);
+    }
+    if(obj == NULL)
+    {
+        obj = old_allocate(size);
     }
-    return hash;
-}
-
-static Obj* allocate_obj(size_t size, ObjType type)
-{
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
     obj->type_fields.type = type;
-    obj->next = vm.objects;
-    obj->type_fields.marked = false;
+    obj->type_fields.marked = ALLOC_MARK();
+    obj->type_fields.immortal = false;
     obj->type_fields.defined = false;
-    vm.objects = obj;
+    obj->type_fields.remembered = false;
+    obj->type_fields.forwarded = false;
+    if(vm.running && !IS_YOUNG(obj))
+    {
+        remember_obj(obj);
+    }
 #ifdef DEBUG_LOG_GC
-    printf("%p allocated %zu bytes for %s\n", (void*)obj, size, get_obj_type_name(type));
+    if(vm.log_gc)
+    {
+        printf("%p allocated %zu bytes for %s\n", (void*)obj, size, get_obj_type_name(type));
+    }
 #endif
     return obj;
 }
 
-static ObjString* allocate_str(const char* chars, size_t len)
+static ObjString* allocate_str(const char* chars, size_t len, uint32_t hash)
 {
     ObjString* str = ALLOCATE_STR(len + 1);
     str->len = len;
-    memcpy(str->chars, chars, len);
+    // chars may be NULL for the empty string
+    if(len > 0)
+    {
+        memcpy(str->chars, chars, len);
+    }
     str->chars[len] = 0;
-    str->hash = hash_str(str->chars, str->len);
+    str->hash = hash;
+    str->encoding = STR_UNCHECKED;
     hash_table_insert(&vm.strings, str, false, NULL_VAL);
     return str;
 }
@@ -57,16 +77,84 @@ static ObjArray* allocate_array(int64_t len)
     return array;
 }
 
-ObjString* take_str(char* chars, size_t len)
+// interned string with a copy of chars
+static ObjString* intern_str(const char* chars, size_t len)
 {
-    uint32_t hash = hash_str(chars, len);
+    uint32_t hash = hash_bytes(chars, len);
     ObjString* interned = hash_table_find_str(&vm.strings, chars, len, hash);
     if(interned != NULL)
     {
-        FREE_ARRAY(char, chars, len);
         return interned;
     }
-    ObjString* res = allocate_str(chars, len);
+    return allocate_str(chars, len, hash);
+}
+
+// made before the program runs so they are allocated in the old space
+static ObjString* immortal_str(const char* chars, size_t len)
+{
+    ObjString* str = intern_str(chars, len);
+    str->obj.type_fields.immortal = true;
+    return str;
+}
+
+void init_str_caches()
+{
+    for(size_t i = 0; i < 256; i++)
+    {
+        char c = (char)i;
+        vm.char_strs[i] = immortal_str(&c, 1);
+    }
+    char buffer[INT_DEC_STR_MAX];
+    for(int64_t i = 0; i < SMALL_INT_STRS; i++)
+    {
+        vm.int_strs[i] = immortal_str(buffer, int_to_dec_buffer(i, buffer));
+    }
+}
+
+static bool is_ascii(const char* chars, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        if(chars[i] & 0x80)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+ObjString* str_code_point(ObjString* str, size_t index)
+{
+    if(str->encoding == STR_UNCHECKED)
+    {
+        str->encoding = is_ascii(str->chars, str->len) ? STR_ASCII : STR_UTF8;
+    }
+    if(str->encoding == STR_ASCII)
+    {
+        return index < str->len ? vm.char_strs[(uint8_t)str->chars[index]] : NULL;
+    }
+    size_t at = 0;
+    size_t offset = 0;
+    while(at < index && offset < str->len)
+    {
+        offset += utf8_char_len(str->chars + offset, str->len - offset);
+        at++;
+    }
+    if(offset >= str->len)
+    {
+        return NULL;
+    }
+    uint8_t char_len = utf8_char_len(str->chars + offset, str->len - offset);
+    if(char_len == 1)
+    {
+        return vm.char_strs[(uint8_t)str->chars[offset]];
+    }
+    return intern_str(str->chars + offset, char_len);
+}
+
+ObjString* take_str(char* chars, size_t len)
+{
+    ObjString* res = intern_str(chars, len);
     FREE_ARRAY(char, chars, len);
     return res;
 }
@@ -203,14 +291,14 @@ ObjString* copy_str(const char* chars, size_t len)
     {
         res_chars[pos] = chars[i];
     }
-    uint32_t hash = hash_str(res_chars, res_len);
-    ObjString* interned = hash_table_find_str(&vm.strings, res_chars, len, hash);
+    uint32_t hash = hash_bytes(res_chars, res_len);
+    ObjString* interned = hash_table_find_str(&vm.strings, res_chars, res_len, hash);
     if(interned != NULL)
     {
         FREE_ARRAY(char, res_chars, res_len);
         return interned;
     }
-    ObjString* res = allocate_str(res_chars, res_len);
+    ObjString* res = allocate_str(res_chars, res_len, hash);
     FREE_ARRAY(char, res_chars, res_len);
     return res;
 }
@@ -225,6 +313,208 @@ ObjString* concat_str(ObjString* a, ObjString* b)
 
 }
 
+static size_t text_len(Obj* text)
+{
+    if(text->type_fields.type == OBJ_ROPE)
+    {
+        return ((ObjRope*)text)->len;
+    }
+    return ((ObjString*)text)->len;
+}
+
+Obj* concat_text(Obj* a, Obj* b)
+{
+    size_t len = text_len(a) + text_len(b);
+    if(len < ROPE_MIN_LEN)
+    {
+        // neither side can be a rope
+        return (Obj*)concat_str((ObjString*)a, (ObjString*)b);
+    }
+    if(text_len(a) == 0)
+    {
+        return b;
+    }
+    if(text_len(b) == 0)
+    {
+        return a;
+    }
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->len = len;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    return (Obj*)rope;
+}
+
+// long pieces are joined by reference rather than copied, keeping repeated appends linear
+static bool is_linked_piece(Value piece)
+{
+    return IS_ROPE(piece) || (IS_STRING(piece) && AS_STRING(piece)->len >= ROPE_MIN_LEN);
+}
+
+static size_t piece_max_len(Value piece)
+{
+    switch(VALUE_TYPE(piece))
+    {
+        case VAL_BOOL:
+        {
+            return 5;
+        }
+        case VAL_NULL:
+        {
+            return 4;
+        }
+        case VAL_INT:
+        {
+            return INT_DEC_STR_MAX;
+        }
+        case VAL_FLOAT:
+        {
+            return FLOAT_STR_MAX;
+        }
+        default:
+        {
+            return is_linked_piece(piece) ? 0 : AS_STRING(piece)->len;
+        }
+    }
+}
+
+static size_t write_piece(char* buffer, Value piece)
+{
+    switch(VALUE_TYPE(piece))
+    {
+        case VAL_BOOL:
+        {
+            memcpy(buffer, AS_BOOL(piece) ? "true" : "false", AS_BOOL(piece) ? 4 : 5);
+            return AS_BOOL(piece) ? 4 : 5;
+        }
+        case VAL_NULL:
+        {
+            memcpy(buffer, "null", 4);
+            return 4;
+        }
+        case VAL_INT:
+        {
+            return int_to_dec_buffer(AS_INT(piece), buffer);
+        }
+        case VAL_FLOAT:
+        {
+            return float_to_buffer(AS_FLOAT(piece), buffer);
+        }
+        default:
+        {
+            ObjString* str = AS_STRING(piece);
+            memcpy(buffer, str->chars, str->len);
+            return str->len;
+        }
+    }
+}
+
+static Obj* append_text(Obj* text, Obj* piece)
+{
+    if(piece == NULL)
+    {
+        return text;
+    }
+    return text == NULL ? piece : concat_text(text, piece);
+}
+
+Obj* build_text(Value* pieces, size_t count)
+{
+    size_t max_len = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(VALUE_TYPE(pieces[i]) == VAL_OBJ && !IS_TEXT(pieces[i]))
+        {
+            pieces[i] = OBJ_VAL((Obj*)obj_to_str(pieces[i]));
+        }
+        max_len += piece_max_len(pieces[i]);
+    }
+    char* chars = ALLOCATE(char, max_len);
+    size_t len = 0;
+    Obj* text = NULL;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(is_linked_piece(pieces[i]))
+        {
+            // the characters gathered so far become one string in front of the piece
+            if(len > 0)
+            {
+                text = append_text(text, (Obj*)intern_str(chars, len));
+                len = 0;
+            }
+            text = append_text(text, AS_OBJ(pieces[i]));
+        }
+        else
+        {
+            len += write_piece(chars + len, pieces[i]);
+        }
+    }
+    if(text == NULL || len > 0)
+    {
+        text = append_text(text, (Obj*)intern_str(chars, len));
+    }
+    FREE_ARRAY(char, chars, max_len);
+    return text;
+}
+
+/* Flattening
+ * The characters are written from the end backwards, taking right halves first
+ * the work list stays short for ropes grown by appending, which lean left
+ */
+ObjString* flatten_rope(ObjRope* rope)
+{
+    if(rope->flat != NULL)
+    {
+        return rope->flat;
+    }
+    char* chars = ALLOCATE(char, rope->len);
+    size_t pos = rope->len;
+    size_t pending_size = 0;
+    size_t pending_capacity = 8;
+    Obj** pending = (Obj**)malloc(sizeof(Obj*) * pending_capacity);
+    if(pending == NULL)
+    {
+        exit(1);
+    }
+    pending[pending_size++] = (Obj*)rope;
+    while(pending_size > 0)
+    {
+        Obj* text = pending[--pending_size];
+        if(text->type_fields.type == OBJ_ROPE && ((ObjRope*)text)->flat != NULL)
+        {
+            text = (Obj*)((ObjRope*)text)->flat;
+        }
+        if(text->type_fields.type == OBJ_ROPE)
+        {
+            if(pending_size + 2 > pending_capacity)
+            {
+                pending_capacity *= 2;
+                pending = (Obj**)realloc(pending, sizeof(Obj*) * pending_capacity);
+                if(pending == NULL)
+                {
+                    exit(1);
+                }
+            }
+            pending[pending_size++] = ((ObjRope*)text)->left;
+            pending[pending_size++] = ((ObjRope*)text)->right;
+        }
+        else
+        {
+            ObjString* str = (ObjString*)text;
+            pos -= str->len;
+            memcpy(chars + pos, str->chars, str->len);
+        }
+    }
+    free(pending);
+    ObjString* flat = take_str(chars, rope->len);
+    rope->flat = flat;
+    rope->left = NULL;
+    rope->right = NULL;
+    WRITE_BARRIER(rope, OBJ_VAL((Obj*)flat));
+    return flat;
+}
+
 ObjString* obj_to_str(Value value)
 {
     switch(OBJ_TYPE(value))
@@ -235,15 +525,19 @@ ObjString* obj_to_str(Value value)
         }
         case OBJ_ARRAY:
         {
-            ObjString* res = copy_str("[", 1);
+            Obj* res = (Obj*)copy_str("[", 1);
             for(size_t i = 0; i < AS_ARRAY(value)->len - 1; i++)
             {
-                res = concat_str(res, value_to_str(AS_CARRAY(value)[i])); 
-                res = concat_str(res, copy_str(", ", 2));
+                res = concat_text(res, (Obj*)value_to_str(AS_CARRAY(value)[i]));
+                res = concat_text(res, (Obj*)copy_str(", ", 2));
             }
-            res = concat_str(res, value_to_str(AS_CARRAY(value)[AS_ARRAY(value)->len - 1]));
-            res = concat_str(res, copy_str("]", 1));
-            return res;
+            res = concat_text(res, (Obj*)value_to_str(AS_CARRAY(value)[AS_ARRAY(value)->len - 1]));
+            res = concat_text(res, (Obj*)copy_str("]", 1));
+            if(res->type_fields.type == OBJ_ROPE)
+            {
+                return flatten_rope((ObjRope*)res);
+            }
+            return (ObjString*)res;
         }
         case OBJ_FUNC:
         {
@@ -285,6 +579,16 @@ ObjString* obj_to_str(Value value)
         {
             return obj_to_str(OBJ_VAL((Obj*)AS_BOUND_METHOD(value)->method));
         }
+        case OBJ_ROPE:
+        {
+            return flatten_rope(AS_ROPE(value));
+        }
+#ifdef NAN_BOXING
+        case OBJ_INT:
+        {
+            return value_to_str(value);
+        }
+#endif
         default:
         {
             return copy_str("Unknown Object", 14);
@@ -319,6 +623,8 @@ ObjFunc* new_func()
     func->name = NULL;
     func->num_inputs = 0;
     func->offset = 0;
+    func->entry = 0;
+    func->max_stack = 0;
     return func;
 }
 
@@ -354,14 +660,19 @@ ObjClass* new_class(ObjString* name)
     ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name = name;
     init_hash_table(&klass->attributes);
+    init_value_array(&klass->fields);
     return klass;
 }
 
 ObjInstance* new_instance(ObjClass* klass)
 {
-    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    ObjInstance* instance = ALLOCATE_INSTANCE(klass->fields.size);
     instance->klass = klass;
-    copy_hash_table(&klass->attributes, &instance->attributes);
+    instance->num_fields = klass->fields.size;
+    if(klass->fields.size > 0)
+    {
+        memcpy(instance->fields, klass->fields.values, sizeof(Value) * klass->fields.size);
+    }
     return instance;
 }
 
@@ -373,7 +684,21 @@ ObjBoundMethod* new_bound_method(Value reciever, Obj* method)
     return bound;
 }
 
-#ifdef DEBUG_LOG_GC
+#ifdef NAN_BOXING
+
+Value box_int(int64_t value)
+{
+    ObjInt* boxed = ALLOCATE_OBJ(ObjInt, OBJ_INT);
+    boxed->value = value;
+    return OBJ_VAL((Obj*)boxed);
+}
+
+int64_t unbox_int(Value value)
+{
+    return ((ObjInt*)AS_OBJ(value))->value;
+}
+
+#endif
 
 const char* get_obj_type_name(ObjType type)
 {
@@ -415,11 +740,19 @@ const char* get_obj_type_name(ObjType type)
         {
             return "bound method";
         }
+        case OBJ_ROPE:
+        {
+            return "rope";
+        }
+#ifdef NAN_BOXING
+        case OBJ_INT:
+        {
+            return "boxed int";
+        }
+#endif
         default:
         {
             return "unknown";
         }
     }
 }
-
-#endif
@@ -1,28 +1,41 @@
 #include <rain_memory.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vm.h>
 #include <object.h>
+#include <time.h>
 
-#ifdef DEBUG_LOG_GC
-#include <stdio.h>
-#include <debug.h>
+#ifdef PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+// larger objects are allocated straight into the old space
+#define NURSERY_MAX_OBJ (NURSERY_SIZE / 8)
 
+/* Collection is never done inside an allocation
+ * C code holds raw object pointers across allocations within an instruction
+ * and minor collections move objects, so allocations only request a collection
+ * and the vm performs it between instructions where every pointer is in a root
+ */
 void* reallocate(void* ptr, size_t old_size, size_t new_size)
 {
     vm.bytes_allocated += new_size;
     vm.bytes_allocated -= old_size;
-    if(vm.running && vm.gc && new_size > old_size)
+    if(new_size > old_size && vm.bytes_allocated > vm.gc_stats.peak_heap)
+    {
+        vm.gc_stats.peak_heap = vm.bytes_allocated;
+    }
+    if(vm.running && new_size > old_size)
     {
-        vm.gc = false;
 #ifdef DEBUG_STRESS_GC
-        collect_garbage();
+        vm.gc_pending = true;
 #else
-        if(vm.bytes_allocated > vm.next_gc)
+        // during a cycle every allocation pays for a slice of marking or sweeping
+        if(vm.bytes_allocated > vm.next_gc || vm.gc_phase != GC_IDLE)
         {
-            collect_garbage();
+            vm.gc_pending = true;
         }
 #endif
     }
@@ -39,102 +52,210 @@ void* reallocate(void* ptr, size_t old_size, size_t new_size)
     return result;
 }
 
-static void free_obj(Obj* obj)
+Obj* old_allocate(size_t size)
 {
-#ifdef DEBUG_LOG_GC
-    printf("%p free type %s\n", (void*)obj, get_obj_type_name(obj->type_fields.type));
+    vm.bytes_allocated += size;
+    if(vm.bytes_allocated > vm.gc_stats.peak_heap)
+    {
+        vm.gc_stats.peak_heap = vm.bytes_allocated;
+    }
+    if(vm.running)
+    {
+#ifdef DEBUG_STRESS_GC
+        vm.gc_pending = true;
+#else
+        if(vm.bytes_allocated > vm.next_gc || vm.gc_phase != GC_IDLE)
+        {
+            vm.gc_pending = true;
+        }
 #endif
+    }
+    return heap_allocate(&vm.heap, size);
+}
+
+void* nursery_allocate(size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if(size > NURSERY_MAX_OBJ || vm.nursery_top + size > vm.nursery_end)
+    {
+        vm.nursery_full = true;
+        vm.gc_pending = true;
+        return NULL;
+    }
+    void* result = vm.nursery_top;
+    vm.nursery_top += size;
+#ifdef DEBUG_STRESS_GC
+    vm.gc_pending = true;
+#else
+    if(vm.gc_phase != GC_IDLE)
+    {
+        vm.gc_pending = true;
+    }
+#endif
+    return result;
+}
+
+// work lists live outside the managed heap so pushing never requests a collection
+static void push_obj(Obj*** stack, size_t* size, size_t* capacity, Obj* obj)
+{
+    if(*size >= *capacity)
+    {
+        *capacity = GROW_CAPACITY(*capacity);
+        *stack = (Obj**)realloc(*stack, sizeof(Obj*) * *capacity);
+        if(*stack == NULL)
+        {
+            exit(1);
+        }
+    }
+    (*stack)[*size] = obj;
+    (*size)++;
+}
+
+void remember_obj(Obj* obj)
+{
+    obj->type_fields.remembered = true;
+    push_obj(&vm.remembered, &vm.remembered_size, &vm.remembered_capacity, obj);
+}
+
+static size_t obj_size(Obj* obj)
+{
     switch(obj->type_fields.type)
     {
         case OBJ_STRING:
         {
-            ObjString* str = (ObjString*)obj;
-            FREE(ObjString, obj);
-            break;
+            return sizeof(ObjString) + ((ObjString*)obj)->len + 1;
         }
         case OBJ_ARRAY:
         {
-            ObjArray* array = (ObjArray*)obj;
-            FREE(ObjArray, array);
-            break;
+            return sizeof(ObjArray) + ((ObjArray*)obj)->len * sizeof(Value);
         }
         case OBJ_FUNC:
         {
-            ObjFunc* func = (ObjFunc*)obj;
-            FREE(ObjFunc, func);
-            break;
+            return sizeof(ObjFunc);
         }
         case OBJ_NATIVE:
         {
-            ObjNative* native = (ObjNative*)obj;
-            FREE(ObjNative, native);
-            break;
+            return sizeof(ObjNative);
         }
         case OBJ_CLOSURE:
         {
-            ObjClosure* closure = (ObjClosure*)obj;
-            FREE(ObjClosure, closure);
-            break;
+            return sizeof(ObjClosure) + ((ObjClosure*)obj)->num_upvalues * sizeof(UpvalueIndex);
         }
         case OBJ_UPVALUE:
         {
-            ObjUpvalue* upvalue = (ObjUpvalue*)obj;
-            FREE(ObjUpvalue, upvalue);
-            break;
+            return sizeof(ObjUpvalue);
         }
         case OBJ_CLASS:
         {
-            ObjClass* klass = (ObjClass*)obj;
-            free_hash_table(&klass->attributes);
-            FREE(ObjClass, klass);
-            break;
+            return sizeof(ObjClass);
         }
         case OBJ_INSTANCE:
         {
-            ObjInstance* instance = (ObjInstance*)obj;
-            free_hash_table(&instance->attributes);
-            FREE(ObjInstance, instance);
-            break;
+            return sizeof(ObjInstance) + ((ObjInstance*)obj)->num_fields * sizeof(Value);
         }
         case OBJ_BOUND_METHOD:
         {
-            ObjBoundMethod* bound = (ObjBoundMethod*)obj;
-            FREE(ObjBoundMethod, bound);
-            break;
+            return sizeof(ObjBoundMethod);
+        }
+        case OBJ_ROPE:
+        {
+            return sizeof(ObjRope);
+        }
+#ifdef NAN_BOXING
+        case OBJ_INT:
+        {
+            return sizeof(ObjInt);
         }
+#endif
         default:
         {
-            break;
+            return sizeof(Obj);
         }
     }
 }
 
+static void free_obj(Obj* obj)
+{
+#ifdef DEBUG_LOG_GC
+    if(vm.log_gc)
+    {
+        printf("%p free type %s\n", (void*)obj, get_obj_type_name(obj->type_fields.type));
+    }
+#endif
+    if(obj->type_fields.type == OBJ_CLASS)
+    {
+        ObjClass* klass = (ObjClass*)obj;
+        free_hash_table(&klass->attributes);
+        free_value_array(&klass->fields);
+    }
+    size_t size = obj_size(obj);
+    vm.bytes_allocated -= size;
+    vm.gc_stats.bytes_freed += size;
+    heap_free(&vm.heap, obj, size);
+}
+
+#ifdef PARALLEL_MARK
+// local stacks above this size hand their oldest half to their shared deque
+#define MARK_SHARE_THRESHOLD 64
+
+typedef struct {
+    // only touched by the worker itself
+    Obj** local;
+    size_t local_size;
+    size_t local_capacity;
+    // work other workers may steal, taken from the front
+    pthread_mutex_t lock;
+    Obj** shared;
+    size_t shared_head;
+    size_t shared_size;
+    size_t shared_capacity;
+} MarkWorker;
+
+// set on the threads taking part in a parallel mark
+static _Thread_local MarkWorker* mark_worker = NULL;
+
+static void parallel_mark_obj(Obj* obj)
+{
+    if(__atomic_exchange_n(&obj->type_fields.marked, vm.mark_bit, __ATOMIC_RELAXED) != vm.mark_bit)
+    {
+        push_obj(&mark_worker->local, &mark_worker->local_size, &mark_worker->local_capacity, obj);
+    }
+}
+#endif
+
+// young objects are left to minor collections, which mark them as they are promoted
 void mark_obj(Obj* obj)
 {
-    if(obj != NULL && obj->type_fields.marked != vm.mark_bit)
+#ifdef PARALLEL_MARK
+    if(mark_worker != NULL)
     {
-#ifdef DEBUG_LOG_GC
-        printf("%p marked\n", (void*)obj);
+        if(obj != NULL && !IS_YOUNG(obj))
+        {
+            parallel_mark_obj(obj);
+        }
+        return;
+    }
 #endif
-        obj->type_fields.marked = vm.mark_bit;
-        if(vm.gray_size >= vm.gray_capacity)
+    if(obj != NULL && obj->type_fields.marked != vm.mark_bit && !IS_YOUNG(obj))
+    {
+#ifdef DEBUG_LOG_GC
+        if(vm.log_gc)
         {
-            vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
-            vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
-            if(vm.gray_stack == NULL)
-            {
-                exit(1);
-            }
+            printf("%p marked\n", (void*)obj);
         }
-        vm.gray_stack[vm.gray_size] = obj;
-        vm.gray_size++;
+#endif
+        obj->type_fields.marked = vm.mark_bit;
+        push_obj(&vm.gray_stack, &vm.gray_size, &vm.gray_capacity, obj);
     }
 }
 
 static void process_obj(Obj* obj)
 {
 #ifdef DEBUG_LOG_GC
-    printf("%p processing\n", (void*)obj);
+    if(vm.log_gc)
+    {
+        printf("%p processing\n", (void*)obj);
+    }
 #endif
     switch(obj->type_fields.type)
     {
@@ -192,12 +313,38 @@ static void process_obj(Obj* obj)
         {
             ObjClass* klass = (ObjClass*)obj;
             mark_obj((Obj*)klass->name);
+            for(size_t i = 0; i < klass->attributes.capacity; i++)
+            {
+                Entry* entry = &klass->attributes.entries[i];
+                if(entry->key != NULL)
+                {
+                    mark_obj((Obj*)entry->key);
+                    if(IS_OBJ(entry->var.value))
+                    {
+                        mark_obj(AS_OBJ(entry->var.value));
+                    }
+                }
+            }
+            for(size_t i = 0; i < klass->fields.size; i++)
+            {
+                if(IS_OBJ(klass->fields.values[i]))
+                {
+                    mark_obj(AS_OBJ(klass->fields.values[i]));
+                }
+            }
             break;
         }
         case OBJ_INSTANCE:
         {
             ObjInstance* instance = (ObjInstance*)obj;
             mark_obj((Obj*)instance->klass);
+            for(size_t i = 0; i < instance->num_fields; i++)
+            {
+                if(IS_OBJ(instance->fields[i]))
+                {
+                    mark_obj(AS_OBJ(instance->fields[i]));
+                }
+            }
             break;
         }
         case OBJ_BOUND_METHOD:
@@ -210,6 +357,20 @@ static void process_obj(Obj* obj)
             mark_obj((Obj*)bound->method);
             break;
         }
+        case OBJ_ROPE:
+        {
+            ObjRope* rope = (ObjRope*)obj;
+            mark_obj(rope->left);
+            mark_obj(rope->right);
+            mark_obj((Obj*)rope->flat);
+            break;
+        }
+#ifdef NAN_BOXING
+        case OBJ_INT:
+        {
+            break;
+        }
+#endif
         default:
         {
             printf("GC unknown object\n");
@@ -218,15 +379,213 @@ static void process_obj(Obj* obj)
     }
 }
 
+/* Minor collections
+ * Every object in the nursery reachable from the roots or the remembered set
+ * is copied into the old space, the nursery copy is then marked forwarded and
+ * overwritten with a pointer to the old copy
+ */
+static Obj* promote(Obj* obj)
+{
+    if(obj->type_fields.forwarded)
+    {
+        return FORWARDED_TO(obj);
+    }
+    size_t size = obj_size(obj);
+    Obj* copy = old_allocate(size);
+    memcpy(copy, obj, size);
+    copy->type_fields.marked = ALLOC_MARK();
+    copy->type_fields.remembered = false;
+    if(obj->type_fields.type == OBJ_UPVALUE)
+    {
+        ObjUpvalue* upvalue = (ObjUpvalue*)obj;
+        if(upvalue->value == &upvalue->closed)
+        {
+            ((ObjUpvalue*)copy)->value = &((ObjUpvalue*)copy)->closed;
+        }
+    }
+    obj->type_fields.forwarded = true;
+    FORWARDED_TO(obj) = copy;
+#ifdef DEBUG_LOG_GC
+    if(vm.log_gc)
+    {
+        printf("%p promoted to %p\n", (void*)obj, (void*)copy);
+    }
+#endif
+    push_obj(&vm.promoted, &vm.promoted_size, &vm.promoted_capacity, copy);
+    return copy;
+}
+
+static void evacuate_obj(Obj** slot)
+{
+    if(*slot != NULL && IS_YOUNG(*slot))
+    {
+        *slot = promote(*slot);
+    }
+}
+
+static void evacuate_value(Value* slot)
+{
+    if(IS_OBJ(*slot) && IS_YOUNG(AS_OBJ(*slot)))
+    {
+        *slot = OBJ_VAL(promote(AS_OBJ(*slot)));
+    }
+}
+
+static void scan_obj(Obj* obj)
+{
+    switch(obj->type_fields.type)
+    {
+        case OBJ_UPVALUE:
+        {
+            ObjUpvalue* upvalue = (ObjUpvalue*)obj;
+            if(upvalue->value == &upvalue->closed)
+            {
+                evacuate_value(&upvalue->closed);
+            }
+            else
+            {
+                evacuate_obj((Obj**)&upvalue->next);
+            }
+            break;
+        }
+        case OBJ_FUNC:
+        {
+            ObjFunc* func = (ObjFunc*)obj;
+            evacuate_obj((Obj**)&func->name);
+            break;
+        }
+        case OBJ_ARRAY:
+        {
+            ObjArray* array = (ObjArray*)obj;
+            for(int64_t i = 0; i < array->len; i++)
+            {
+                evacuate_value(&array->data[i]);
+            }
+            break;
+        }
+        case OBJ_NATIVE:
+        {
+            ObjNative* native = (ObjNative*)obj;
+            evacuate_obj((Obj**)&native->name);
+            break;
+        }
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)obj;
+            evacuate_obj((Obj**)&closure->func);
+            if(closure->obj.type_fields.defined)
+            {
+                for(size_t i = 0; i < closure->num_upvalues; i++)
+                {
+                    evacuate_obj((Obj**)&closure->upvalues[i].upvalue);
+                }
+            }
+            break;
+        }
+        case OBJ_CLASS:
+        {
+            ObjClass* klass = (ObjClass*)obj;
+            for(size_t i = 0; i < klass->attributes.capacity; i++)
+            {
+                Entry* entry = &klass->attributes.entries[i];
+                if(entry->key != NULL)
+                {
+                    evacuate_value(&entry->var.value);
+                }
+            }
+            for(size_t i = 0; i < klass->fields.size; i++)
+            {
+                evacuate_value(&klass->fields.values[i]);
+            }
+            break;
+        }
+        case OBJ_INSTANCE:
+        {
+            ObjInstance* instance = (ObjInstance*)obj;
+            for(size_t i = 0; i < instance->num_fields; i++)
+            {
+                evacuate_value(&instance->fields[i]);
+            }
+            break;
+        }
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod* bound = (ObjBoundMethod*)obj;
+            evacuate_value(&bound->reciever);
+            evacuate_obj((Obj**)&bound->method);
+            break;
+        }
+        case OBJ_ROPE:
+        {
+            ObjRope* rope = (ObjRope*)obj;
+            evacuate_obj(&rope->left);
+            evacuate_obj(&rope->right);
+            evacuate_obj((Obj**)&rope->flat);
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+void minor_collect()
+{
+    size_t before = vm.bytes_allocated;
+    if(vm.log_gc)
+    {
+        printf("\n-- minor gc begin\n");
+    }
+    for(Value* slot = vm.stack; slot < vm.stack_top; slot++)
+    {
+        evacuate_value(slot);
+    }
+    for(size_t i = 0; i < vm.chunk->globals.size; i++)
+    {
+        evacuate_value(&vm.chunk->globals.values[i]);
+    }
+    for(ObjUpvalue** upvalue = &vm.open_upvalues; *upvalue != NULL; upvalue = (ObjUpvalue**)&(*upvalue)->next)
+    {
+        evacuate_obj((Obj**)upvalue);
+    }
+    for(size_t i = 0; i < vm.remembered_size; i++)
+    {
+        vm.remembered[i]->type_fields.remembered = false;
+        scan_obj(vm.remembered[i]);
+    }
+    vm.remembered_size = 0;
+    while(vm.promoted_size > 0)
+    {
+        vm.promoted_size--;
+        Obj* obj = vm.promoted[vm.promoted_size];
+        scan_obj(obj);
+        // promoted objects may hold the only reference to white objects
+        if(vm.gc_phase == GC_MARK)
+        {
+            mark_obj(obj);
+        }
+    }
+    hash_table_remove_young(&vm.strings);
+    vm.nursery_top = vm.nursery;
+    vm.nursery_full = false;
+    vm.gc_stats.minor_collections++;
+    if(vm.log_gc)
+    {
+        printf("-- minor gc end\n");
+        printf("   promoted %zu bytes\n", vm.bytes_allocated - before);
+    }
+}
+
 void free_objs()
 {
-    Obj* obj = vm.objects;
-    while(obj != NULL)
+    HeapCursor cursor;
+    heap_cursor_init(&vm.heap, &cursor);
+    for(Obj* obj = heap_cursor_next(&vm.heap, &cursor); obj != NULL; obj = heap_cursor_next(&vm.heap, &cursor))
     {
-        Obj* next = obj->next;
         free_obj(obj);
-        obj = next;
     }
+    free_heap(&vm.heap);
 }
 
 static void mark_roots()
@@ -260,8 +619,216 @@ static void mark_roots()
     }
 }
 
+#ifdef PARALLEL_MARK
+/* Parallel marking
+ * The gray stack is dealt out to vm.gc_config.threads workers which each drain a private
+ * stack. A worker with plenty of work and an empty shared deque moves its oldest half
+ * there, and a worker which runs dry takes its own shared work back or steals half of
+ * another worker's. Marks are set with an atomic exchange so each object is processed
+ * once, and marking ends when every worker is idle with nothing left to steal
+ */
+typedef struct {
+    MarkWorker* workers;
+    size_t num_workers;
+    size_t idle;
+} MarkTeam;
+
+static size_t shared_size(MarkWorker* worker)
+{
+    return __atomic_load_n(&worker->shared_size, __ATOMIC_RELAXED);
+}
+
+static void share_work(MarkWorker* worker)
+{
+    size_t half = worker->local_size / 2;
+    pthread_mutex_lock(&worker->lock);
+    size_t size = worker->shared_size;
+    if(size + half > worker->shared_capacity)
+    {
+        worker->shared_capacity = size + half > 2 * worker->shared_capacity ? size + half : 2 * worker->shared_capacity;
+        worker->shared = (Obj**)realloc(worker->shared, sizeof(Obj*) * worker->shared_capacity);
+        if(worker->shared == NULL)
+        {
+            exit(1);
+        }
+    }
+    memcpy(worker->shared + size, worker->local, sizeof(Obj*) * half);
+    // other workers check for work without taking the lock
+    __atomic_store_n(&worker->shared_size, size + half, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->lock);
+    memmove(worker->local, worker->local + half, sizeof(Obj*) * (worker->local_size - half));
+    worker->local_size -= half;
+}
+
+// moves half of victim's shared work, at least one object, to thief's local stack
+static bool steal_work(MarkWorker* thief, MarkWorker* victim)
+{
+    if(shared_size(victim) == 0)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&victim->lock);
+    size_t available = victim->shared_size - victim->shared_head;
+    size_t taken = (available + 1) / 2;
+    for(size_t i = 0; i < taken; i++)
+    {
+        push_obj(&thief->local, &thief->local_size, &thief->local_capacity, victim->shared[victim->shared_head + i]);
+    }
+    victim->shared_head += taken;
+    if(victim->shared_head == victim->shared_size)
+    {
+        victim->shared_head = 0;
+        __atomic_store_n(&victim->shared_size, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return taken > 0;
+}
+
+static bool find_work(MarkTeam* team, MarkWorker* worker)
+{
+    if(steal_work(worker, worker))
+    {
+        return true;
+    }
+    for(size_t i = 0; i < team->num_workers; i++)
+    {
+        if(steal_work(worker, &team->workers[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_mark_worker(MarkTeam* team, MarkWorker* worker)
+{
+    mark_worker = worker;
+    for(;;)
+    {
+        while(worker->local_size > 0)
+        {
+            worker->local_size--;
+            process_obj(worker->local[worker->local_size]);
+            if(worker->local_size > MARK_SHARE_THRESHOLD && shared_size(worker) == 0)
+            {
+                share_work(worker);
+            }
+        }
+        if(find_work(team, worker))
+        {
+            continue;
+        }
+        // only owners add shared work, so once everyone is idle there is none left
+        __atomic_add_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+        bool done = false;
+        while(!done)
+        {
+            bool work_left = false;
+            for(size_t i = 0; i < team->num_workers && !work_left; i++)
+            {
+                work_left = shared_size(&team->workers[i]) > 0;
+            }
+            if(work_left)
+            {
+                __atomic_sub_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            done = __atomic_load_n(&team->idle, __ATOMIC_SEQ_CST) == team->num_workers;
+            if(!done)
+            {
+                sched_yield();
+            }
+        }
+        if(done)
+        {
+            break;
+        }
+    }
+    mark_worker = NULL;
+}
+
+typedef struct {
+    MarkTeam* team;
+    MarkWorker* worker;
+} MarkThreadArgs;
+
+static void* mark_thread(void* arg)
+{
+    MarkThreadArgs* args = (MarkThreadArgs*)arg;
+    run_mark_worker(args->team, args->worker);
+    return NULL;
+}
+
+static void parallel_trace_refs()
+{
+    MarkTeam team;
+    team.num_workers = vm.gc_config.threads;
+    team.idle = 0;
+    team.workers = (MarkWorker*)malloc(sizeof(MarkWorker) * team.num_workers);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * team.num_workers);
+    MarkThreadArgs* args = (MarkThreadArgs*)malloc(sizeof(MarkThreadArgs) * team.num_workers);
+    if(team.workers == NULL || threads == NULL || args == NULL)
+    {
+        exit(1);
+    }
+    for(size_t i = 0; i < team.num_workers; i++)
+    {
+        MarkWorker* worker = &team.workers[i];
+        worker->local = NULL;
+        worker->local_size = 0;
+        worker->local_capacity = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->shared = NULL;
+        worker->shared_head = 0;
+        worker->shared_size = 0;
+        worker->shared_capacity = 0;
+    }
+    // the collecting thread is worker 0 and starts with the gray stack, half of it up for stealing
+    for(size_t i = 0; i < vm.gray_size; i++)
+    {
+        push_obj(&team.workers[0].local, &team.workers[0].local_size, &team.workers[0].local_capacity, vm.gray_stack[i]);
+    }
+    vm.gray_size = 0;
+    share_work(&team.workers[0]);
+    size_t started = 1;
+    for(size_t i = 1; i < team.num_workers; i++)
+    {
+        args[i].team = &team;
+        args[i].worker = &team.workers[i];
+        if(pthread_create(&threads[i], NULL, mark_thread, &args[i]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    // workers which failed to start hold no work and count as idle
+    __atomic_add_fetch(&team.idle, team.num_workers - started, __ATOMIC_SEQ_CST);
+    run_mark_worker(&team, &team.workers[0]);
+    for(size_t i = 1; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for(size_t i = 0; i < team.num_workers; i++)
+    {
+        pthread_mutex_destroy(&team.workers[i].lock);
+        free(team.workers[i].local);
+        free(team.workers[i].shared);
+    }
+    free(team.workers);
+    free(threads);
+    free(args);
+}
+#endif
+
 static void trace_refs()
 {
+#ifdef PARALLEL_MARK
+    if(vm.gc_config.threads > 1)
+    {
+        parallel_trace_refs();
+        return;
+    }
+#endif
     while(vm.gray_size > 0)
     {
         vm.gray_size--;
@@ -270,48 +837,191 @@ static void trace_refs()
     }
 }
 
-static void sweep()
+static size_t sweep_start_bytes;
+
+// objects kept so far by the current sweep, published to gc_stats once it finishes
+static size_t sweep_live[NUM_OBJ_TYPES];
+
+static void set_next_gc()
+{
+    vm.next_gc = (size_t)(vm.bytes_allocated * vm.gc_config.growth_factor);
+    if(vm.gc_config.max_heap != 0 && vm.next_gc > vm.gc_config.max_heap)
+    {
+        vm.next_gc = vm.gc_config.max_heap;
+    }
+}
+
+/* Lazy sweeping
+ * Marking hands the heap to the sweeper and the mutator resumes straight away
+ * each safe point after an allocation then visits at most sweep_budget objects of the
+ * old space pages. mark_bit is only flipped once the whole heap is swept, objects made
+ * in between are allocated with the current mark so the sweeper keeps them
+ */
+static void finish_sweep()
+{
+    heap_release_empty_pages(&vm.heap);
+    vm.mark_bit = !vm.mark_bit;
+    set_next_gc();
+    vm.gc_phase = GC_IDLE;
+    memcpy(vm.gc_stats.live_objects, sweep_live, sizeof(sweep_live));
+    vm.gc_stats.collections++;
+    if(vm.log_gc)
+    {
+        printf("\n-- gc end\n");
+        printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", sweep_start_bytes - vm.bytes_allocated, sweep_start_bytes, vm.bytes_allocated, vm.next_gc);
+    }
+}
+
+static void sweep(size_t budget)
 {
-    Obj* prev = NULL;
-    Obj* obj = vm.objects;
-    while(obj != NULL)
+    for(size_t work = 0; work < budget; work++)
     {
-        if(obj->type_fields.marked == vm.mark_bit || obj->type_fields.immortal)
+        Obj* obj = heap_cursor_next(&vm.heap, &vm.sweep_cursor);
+        if(obj == NULL)
+        {
+            finish_sweep();
+            return;
+        }
+        if(obj->type_fields.marked != vm.mark_bit && !obj->type_fields.immortal)
         {
-            prev = obj;
-            obj = obj->next;
+            free_obj(obj);
         }
         else
         {
-            Obj* trash = obj;
-            obj = obj->next;
-            if(prev != NULL)
-            {
-                prev->next = obj;
-            }
-            else
-            {
-                vm.objects = obj;
-            }
-            free_obj(trash);
+            sweep_live[obj->type_fields.type]++;
         }
     }
 }
 
-void collect_garbage()
+/* Incremental marking
+ * A cycle starts by graying the roots, then every safe point after an allocation
+ * processes at most mark_budget gray objects, while WRITE_BARRIER keeps stores into
+ * black objects from hiding white ones. The stack and globals have no barrier so
+ * finishing a cycle empties the nursery and marks the roots again before sweeping
+ */
+static void begin_mark()
 {
-#ifdef DEBUG_LOG_GC
-    printf("\n-- gc begin\n");
-    size_t before = vm.bytes_allocated;
-#endif
+    if(vm.log_gc)
+    {
+        printf("\n-- gc begin\n");
+    }
+    vm.gc_phase = GC_MARK;
+    mark_roots();
+}
+
+static void finish_mark()
+{
+    minor_collect();
     mark_roots();
     trace_refs();
+    // interned strings are looked up without being marked so dead ones go before sweeping
     hash_table_remove_clear(&vm.strings);
-    sweep();
-    vm.mark_bit = !vm.mark_bit;
-    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
-#ifdef DEBUG_LOG_GC
-    printf("\n-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu", before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+    sweep_start_bytes = vm.bytes_allocated;
+    vm.gc_phase = GC_SWEEP;
+    heap_cursor_init(&vm.heap, &vm.sweep_cursor);
+    memset(sweep_live, 0, sizeof(sweep_live));
+}
+
+static void mark_slice()
+{
+    for(size_t work = 0; work < vm.gc_config.mark_budget && vm.gray_size > 0; work++)
+    {
+        vm.gray_size--;
+        process_obj(vm.gray_stack[vm.gray_size]);
+    }
+    if(vm.gray_size == 0)
+    {
+        finish_mark();
+    }
+}
+
+/* Heap limit
+ * Once the old space goes over max_heap the running cycle is completed and a fresh one
+ * is done in the same pause, since the unfinished cycle keeps whatever died during it
+ */
+static void full_collect()
+{
+    if(vm.gc_phase == GC_MARK)
+    {
+        finish_mark();
+    }
+    if(vm.gc_phase == GC_SWEEP)
+    {
+        sweep(SIZE_MAX);
+    }
+    begin_mark();
+    finish_mark();
+    sweep(SIZE_MAX);
+}
+
+bool collect_garbage()
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vm.gc_pending = false;
+#ifdef DEBUG_STRESS_GC
+    bool minor = true;
+    bool major = true;
+#else
+    bool minor = vm.nursery_full;
+    bool major = vm.bytes_allocated > vm.next_gc;
 #endif
+    if(minor)
+    {
+        minor_collect();
+    }
+    bool within_limit = true;
+    if(vm.gc_config.max_heap != 0 && vm.bytes_allocated > vm.gc_config.max_heap)
+    {
+        full_collect();
+        within_limit = vm.bytes_allocated <= vm.gc_config.max_heap;
+    }
+    else if(vm.gc_phase == GC_IDLE && major)
+    {
+        begin_mark();
+#ifdef INCREMENTAL_GC
+        // parallel marking gets through the heap in one pause instead of slices
+        if(vm.gc_config.threads > 1)
+        {
+            finish_mark();
+        }
+#else
+        finish_mark();
+        sweep(SIZE_MAX);
+#endif
+    }
+    else if(vm.gc_phase == GC_MARK)
+    {
+        mark_slice();
+    }
+    else if(vm.gc_phase == GC_SWEEP)
+    {
+        sweep(vm.gc_config.sweep_budget);
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t pause = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+    vm.gc_stats.pauses++;
+    vm.gc_stats.pause_total_ns += pause;
+    if(pause > vm.gc_stats.pause_max_ns)
+    {
+        vm.gc_stats.pause_max_ns = pause;
+    }
+#ifdef DEBUG_GC_PAUSES
+    fprintf(stderr, "gc pause %lu us\n", (unsigned long)(pause / 1000));
+#endif
+    return within_limit;
+}
+
+void configure_gc(const GCConfig* config)
+{
+    vm.gc_config = *config;
+    if(vm.gc_stats.collections == 0 && vm.gc_phase == GC_IDLE)
+    {
+        vm.next_gc = config->initial_threshold;
+    }
+    if(config->max_heap != 0 && vm.next_gc > config->max_heap)
+    {
+        vm.next_gc = config->max_heap;
+    }
 }
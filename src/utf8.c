@@ -69,3 +69,10 @@ wchar_t decode_utf8_char(const char* letter, uint8_t* char_consumed, size_t len)
     }
     return 0;
 }
+
+uint8_t utf8_char_len(const char* letter, size_t len)
+{
+    uint8_t consumed = 1;
+    decode_utf8_char(letter, &consumed, len);
+    return consumed;
+}
@@ -15,11 +15,11 @@ void init_value_array(ValueArray* array)
 
 bool values_eql(Value a, Value b)
 {
-    if(a.type != b.type)
+    if(VALUE_TYPE(a) != VALUE_TYPE(b))
     {
         return false;
     }
-    switch(a.type)
+    switch(VALUE_TYPE(a))
     {
         case VAL_BOOL:
         {
@@ -39,6 +39,15 @@ bool values_eql(Value a, Value b)
         }
         case VAL_OBJ:
         {
+            // strings are interned, ropes are compared through their flattened string
+            if(IS_ROPE(a))
+            {
+                a = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(a)));
+            }
+            if(IS_ROPE(b))
+            {
+                b = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(b)));
+            }
             return AS_OBJ(a) == AS_OBJ(b);
         }
         default:
@@ -69,15 +78,13 @@ void free_value_array(ValueArray* array)
 
 void print_value(Value value)
 {
-    vm.gc = false;
     ObjString* text = value_to_str(value);
     printf("%s", text->chars);
-    vm.gc = true;
 }
 
 ObjString* value_to_str(Value value)
 {
-    switch(value.type)
+    switch(VALUE_TYPE(value))
     {
         case VAL_FLOAT:
         {
@@ -88,6 +95,10 @@ ObjString* value_to_str(Value value)
         case VAL_INT:
         {
             int64_t num = AS_INT(value);
+            if(num >= 0 && num < SMALL_INT_STRS)
+            {
+                return vm.int_strs[num];
+            }
             char* res_chars = int_to_dec_str(num);
             return take_str(res_chars, strlen(res_chars));
         }
@@ -10,10 +10,9 @@
 #include <string.h>
 #include <convert.h>
 #include <call_stack.h>
+#include <hash.h>
 
-#ifdef DEBUG_TRACE_EXECUTION
 #include <debug.h>
-#endif
 
 VM vm;
 
@@ -22,6 +21,7 @@ static void close_upvalue()
     ObjUpvalue* last = vm.open_upvalues;
     last->closed = *last->value;
     last->value = &last->closed;
+    WRITE_BARRIER(last, last->closed);
     vm.open_upvalues = (ObjUpvalue*)last->next;
 }
 
@@ -32,6 +32,7 @@ static void close_func_upvalues()
         ObjUpvalue* last = vm.open_upvalues;
         last->closed = *last->value;
         last->value = &last->closed;
+        WRITE_BARRIER(last, last->closed);
         vm.open_upvalues = (ObjUpvalue*)last->next;
     }
 }
@@ -40,7 +41,52 @@ static void reset_stack()
 {
     vm.stack_top = vm.stack;
     vm.stack_base = vm.stack;
-    vm.call_base = vm.stack;
+    vm.closure = NULL;
+    vm.frame_count = 0;
+}
+
+/* Stack growth
+ * The stack is reallocated to at least double its size, so everything pointing into it
+ * is moved along: the registers and open upvalues. Frames only hold offsets into it
+ */
+static bool grow_stack(size_t needed)
+{
+    size_t max_slots = vm.stack_max / sizeof(Value);
+    if(needed > max_slots)
+    {
+        return false;
+    }
+    size_t capacity = vm.stack_capacity;
+    while(capacity < needed)
+    {
+        capacity *= 2;
+    }
+    if(capacity > max_slots)
+    {
+        capacity = max_slots;
+    }
+    uintptr_t old = (uintptr_t)vm.stack;
+    Value* stack = (Value*)realloc(vm.stack, sizeof(Value) * capacity);
+    if(stack == NULL)
+    {
+        return false;
+    }
+    vm.stack = stack;
+    vm.stack_capacity = capacity;
+    vm.stack_top = (Value*)((uintptr_t)vm.stack_top - old + (uintptr_t)stack);
+    vm.stack_base = (Value*)((uintptr_t)vm.stack_base - old + (uintptr_t)stack);
+    for(ObjUpvalue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = (ObjUpvalue*)upvalue->next)
+    {
+        upvalue->value = (Value*)((uintptr_t)upvalue->value - old + (uintptr_t)stack);
+    }
+    return true;
+}
+
+// makes room for slots values above stack_top, false if the stack would go over stack_max
+static inline bool ensure_stack(size_t slots)
+{
+    size_t needed = (size_t)(vm.stack_top - vm.stack) + slots;
+    return needed <= vm.stack_capacity || grow_stack(needed);
 }
 
 static void runtime_error(const char* format, ...)
@@ -51,7 +97,7 @@ static void runtime_error(const char* format, ...)
     va_end(args);
     fputs("\n", stderr);
 
-    size_t inst = vm.ip - vm.chunk->code - 1;
+    size_t inst = vm.ip[-1].offset;
     size_t line = get_line_number(&vm.chunk->line_encoding, inst);
     fprintf(stderr, "[line %zu] in script\n", line);
     reset_stack();
@@ -59,18 +105,60 @@ static void runtime_error(const char* format, ...)
 
 void init_vm()
 {
+    init_hash_seed();
+    vm.stack_capacity = STACK_INITIAL_SIZE;
+    vm.stack_max = STACK_MAX_BYTES;
+    vm.stack = (Value*)malloc(sizeof(Value) * vm.stack_capacity);
+    if(vm.stack == NULL)
+    {
+        exit(1);
+    }
+    vm.frame_capacity = FRAMES_INITIAL_SIZE;
+    vm.frames = (CallFrame*)malloc(sizeof(CallFrame) * vm.frame_capacity);
+    if(vm.frames == NULL)
+    {
+        exit(1);
+    }
     reset_stack();
-    vm.objects = NULL;
+    init_heap(&vm.heap);
     vm.open_upvalues = NULL;
     vm.running = false;
-    vm.gc = true;
+    vm.gc_pending = false;
+    vm.nursery_full = false;
+    vm.gc_phase = GC_IDLE;
+    vm.gc_config.growth_factor = GC_GROWTH_FACTOR;
+    vm.gc_config.initial_threshold = GC_INITIAL_THRESHOLD;
+    vm.gc_config.max_heap = 0;
+    vm.gc_config.mark_budget = GC_MARK_BUDGET;
+    vm.gc_config.sweep_budget = GC_SWEEP_BUDGET;
+    vm.gc_config.threads = 1;
+    memset(&vm.gc_stats, 0, sizeof(GCStats));
     vm.gray_size = 0;
     vm.gray_capacity = 0;
     vm.gray_stack = NULL;
     vm.mark_bit = true;
     vm.bytes_allocated = 0;
-    vm.next_gc =  0x1000;
+    vm.next_gc = vm.gc_config.initial_threshold;
+    vm.nursery = (uint8_t*)malloc(NURSERY_SIZE);
+    if(vm.nursery == NULL)
+    {
+        exit(1);
+    }
+    vm.nursery_top = vm.nursery;
+    vm.nursery_end = vm.nursery + NURSERY_SIZE;
+    vm.remembered_size = 0;
+    vm.remembered_capacity = 0;
+    vm.remembered = NULL;
+    vm.promoted_size = 0;
+    vm.promoted_capacity = 0;
+    vm.promoted = NULL;
+    vm.trace_execution = false;
+    vm.print_code = false;
+    vm.log_gc = false;
+    vm.count_dispatch = false;
+    vm.dispatch_count = 0;
     init_hash_table(&vm.strings);
+    init_str_caches();
 }
 
 static Value peek(int64_t distance)
@@ -87,67 +175,13 @@ static Value peek_back(size_t distance)
 
 static void concatenate()
 {
-    ObjString* b = AS_STRING(pop());
-    ObjString* a = AS_STRING(pop());
-    push(OBJ_VAL((Obj*)concat_str(a, b)));
-}
-
-#define READ_INST() (*(vm.ip++))
-
-static size_t read_inst_index(size_t offset_size)
-{
-    size_t offset = 0;
-    size_t index = read_chunk_const(vm.ip, &offset, offset_size);
-    vm.ip += offset;
-    return index;
-}
-
-static Value read_const(size_t offset_size)
-{
-    size_t index = read_inst_index(offset_size);
-    Value val = vm.chunk->consts.values[index];
-    return val;
-}
-
-static Value read_global(size_t offset_size)
-{
-    size_t index = read_inst_index(offset_size);
-    return vm.chunk->globals.values[index];
-}
-
-static void write_global(size_t offset_size, Value value)
-{
-    size_t index = read_inst_index(offset_size);
-    vm.chunk->globals.values[index] = value;
-}
-
-static size_t read_jump(size_t offset_size)
-{
-    uint8_t* data = (uint8_t*)vm.ip;
-    size_t offset = 0;
-    for(size_t i = offset_size; i > 0; i--)
-    {
-        offset |= ((size_t)data[(i - 1)] << ((offset_size - i) * 8));
-    }
-    for(size_t i = 0; i < offset_size; i += sizeof(inst_type))
-    {
-        vm.ip++;
-    }
-    return offset;
+    Obj* b = AS_OBJ(pop());
+    Obj* a = AS_OBJ(pop());
+    push(OBJ_VAL(concat_text(a, b)));
 }
 
-static bool setup_call(size_t expected_inputs)
-{
-    vm.stack_base = vm.call_base;
-    size_t args = (size_t)(vm.stack_top - vm.stack_base);
-    if(args != expected_inputs)
-    {
-        runtime_error("Expected %zu args but got %zu", expected_inputs, args);
-        return false;
-    }
-    vm.stack_base[STACK_RET_ADDR] = INT_VAL((int64_t)(size_t)((vm.ip - vm.chunk->code)));
-    return true;
-}
+// ip is a local of the loop, vm.ip is kept one past the running instruction for calls and errors
+#define READ_INST() (vm.ip = ip + 1, ip++)
 
 static ObjUpvalue* capture_upvalue(Value* loc)
 {
@@ -186,17 +220,49 @@ static void init_closure(ObjClosure* closure)
         }
         else
         {
-            ObjClosure* prev = AS_CLOSURE(vm.stack_base[-4]);
-            loc = prev->upvalues[closure->upvalues[i].indexes.index].upvalue->value;
+            loc = vm.closure->upvalues[closure->upvalues[i].indexes.index].upvalue->value;
         }
         closure->upvalues[i].upvalue = capture_upvalue(loc);
+        WRITE_BARRIER(closure, OBJ_VAL((Obj*)closure->upvalues[i].upvalue));
     }
     closure->obj.type_fields.defined = true;
 }
 
-#define READ_STRING(offset_size) AS_STRING(read_const(offset_size))
+static Entry* find_cached_attr(AttrCache* cache, ObjClass* klass, ObjString* name)
+{
+    for(size_t i = 0; i < ATTR_CACHE_WAYS; i++)
+    {
+        AttrCacheEntry* way = &cache->ways[i];
+        if(way->klass == (Obj*)klass)
+        {
+            if(way->index < klass->attributes.capacity && klass->attributes.entries[way->index].key == name)
+            {
+                return &klass->attributes.entries[way->index];
+            }
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void cache_attr(AttrCache* cache, ObjClass* klass, Entry* entry)
+{
+    size_t way = 0;
+    while(way < ATTR_CACHE_WAYS - 1 && cache->ways[way].klass != NULL && cache->ways[way].klass != (Obj*)klass)
+    {
+        way++;
+    }
+    if(cache->ways[way].klass != NULL && cache->ways[way].klass != (Obj*)klass)
+    {
+        // full, evict the oldest class
+        memmove(&cache->ways[1], &cache->ways[0], sizeof(AttrCacheEntry) * (ATTR_CACHE_WAYS - 1));
+        way = 0;
+    }
+    cache->ways[way].klass = (Obj*)klass;
+    cache->ways[way].index = (size_t)(entry - klass->attributes.entries);
+}
 
-static bool get_attr(size_t bytes, bool get)
+static bool get_attr(ObjString* name, bool get, AttrCache* cache)
 {
     if(!IS_INSTANCE(peek(0)))
     {
@@ -204,36 +270,41 @@ static bool get_attr(size_t bytes, bool get)
         return false;
     }
     ObjInstance* instance = AS_INSTANCE(peek(0));
-    ObjString* name = READ_STRING(bytes);
-    Value val;
-    if(hash_table_get(&instance->attributes, name, &val))
+    Entry* entry = find_cached_attr(cache, instance->klass, name);
+    if(entry == NULL)
     {
-        uint8_t scope = hash_table_get_scope(&instance->attributes, name) - 1;
-        if(!IS_VAR_PUB(scope))
+        entry = hash_table_get_entry(&instance->klass->attributes, name);
+        if(entry == NULL)
         {
-            runtime_error("Trying to access non public attribute '%s'", name->chars);
+            runtime_error("Undefined attribute '%s'", name->chars);
             return false;
         }
-        if(IS_VAR_METHOD(scope))
-        {
-            ObjBoundMethod* bound = new_bound_method(peek(0), AS_OBJ(val));
-            val = OBJ_VAL((Obj*)bound);
-        }
-        if(get)
+        if(!IS_VAR_PUB(entry->var.scope))
         {
-            pop();
+            runtime_error("Trying to access non public attribute '%s'", name->chars);
+            return false;
         }
-        push(val);
+        cache_attr(cache, instance->klass, entry);
+    }
+    Value val;
+    if(IS_VAR_METHOD(entry->var.scope))
+    {
+        ObjBoundMethod* bound = new_bound_method(peek(0), AS_OBJ(entry->var.value));
+        val = OBJ_VAL((Obj*)bound);
     }
     else
     {
-        runtime_error("Undefined attribute '%s'", name->chars);
-        return false;
+        val = instance->fields[AS_INT(entry->var.value)];
+    }
+    if(get)
+    {
+        pop();
     }
+    push(val);
     return true;
 }
 
-static bool get_this_attr(size_t bytes, bool get)
+static bool get_this_attr(ObjString* name, bool get, AttrCache* cache)
 {
     if(!IS_INSTANCE(peek(0)))
     {
@@ -241,106 +312,157 @@ static bool get_this_attr(size_t bytes, bool get)
         return false;
     }
     ObjInstance* instance = AS_INSTANCE(peek(0));
-    ObjString* name = READ_STRING(bytes);
-    Value val;
-    if(hash_table_get(&instance->attributes, name, &val))
+    Entry* entry = find_cached_attr(cache, instance->klass, name);
+    if(entry == NULL)
     {
-        uint8_t scope = hash_table_get_scope(&instance->attributes, name) - 1;
-        if(IS_VAR_METHOD(scope))
-        {
-            ObjBoundMethod* bound = new_bound_method(peek(0), AS_OBJ(val));
-            val = OBJ_VAL((Obj*)bound);
-        }
-        if(get)
+        entry = hash_table_get_entry(&instance->klass->attributes, name);
+        if(entry == NULL)
         {
-            pop();
+            runtime_error("Undefined attribute '%s'", name->chars);
+            return false;
         }
-        push(val);
+        cache_attr(cache, instance->klass, entry);
+    }
+    Value val;
+    if(IS_VAR_METHOD(entry->var.scope))
+    {
+        ObjBoundMethod* bound = new_bound_method(peek(0), AS_OBJ(entry->var.value));
+        val = OBJ_VAL((Obj*)bound);
     }
     else
     {
-        runtime_error("Undefined attribute '%s'", name->chars);
-        return false;
+        val = instance->fields[AS_INT(entry->var.value)];
+    }
+    if(get)
+    {
+        pop();
     }
+    push(val);
     return true;
 }
 
-static bool set_attr(size_t bytes)
+static bool set_attr(ObjString* name, AttrCache* cache)
 {
     if(!IS_INSTANCE(peek(1)))
     {
         runtime_error("Only instances have attributes");
-        return INTERPRET_RUNTIME_ERROR;
+        return false;
     }
     ObjInstance* instance = AS_INSTANCE(peek(1));
-    ObjString* name = READ_STRING(bytes);
-    uint8_t scope = hash_table_get_scope(&instance->attributes, name);
-    if(scope > 0)
+    Entry* entry = find_cached_attr(cache, instance->klass, name);
+    if(entry == NULL)
     {
-        scope -= 1;
-        if(!IS_VAR_PUB(scope))
+        entry = hash_table_get_entry(&instance->klass->attributes, name);
+        if(entry == NULL)
+        {
+            runtime_error("Undefined attribute '%s'", name->chars);
+            return false;
+        }
+        if(!IS_VAR_PUB(entry->var.scope))
         {
             runtime_error("Trying to access non public attribute '%s'", name->chars);
             return false;
         }
-        else if(IS_VAR_CONST(scope))
+        else if(IS_VAR_CONST(entry->var.scope))
         {
             runtime_error("Assigning to constant attribute '%s'", name->chars);
             return false;
         }
-        hash_table_set(&instance->attributes, name, peek(0));
-        Value value = pop();
-        pop();
-        push(value);
-    }
-    else
-    {
-        runtime_error("Undefined attribute '%s'", name->chars);
-        return false;
+        cache_attr(cache, instance->klass, entry);
     }
+    // methods are always constant so entry is a field
+    instance->fields[AS_INT(entry->var.value)] = peek(0);
+    WRITE_BARRIER(instance, peek(0));
+    Value value = pop();
+    pop();
+    push(value);
     return true;
 }
 
-static bool set_this_attr(size_t bytes)
+static bool set_this_attr(ObjString* name, AttrCache* cache)
 {
     if(!IS_INSTANCE(peek(1)))
     {
         runtime_error("Only instances have attributes");
-        return INTERPRET_RUNTIME_ERROR;
+        return false;
     }
     ObjInstance* instance = AS_INSTANCE(peek(1));
-    ObjString* name = READ_STRING(bytes);
-    uint8_t scope = hash_table_get_scope(&instance->attributes, name);
-    if(scope > 0)
+    Entry* entry = find_cached_attr(cache, instance->klass, name);
+    if(entry == NULL)
     {
-        scope -= 1;
-        if(IS_VAR_CONST(scope))
+        entry = hash_table_get_entry(&instance->klass->attributes, name);
+        if(entry == NULL)
+        {
+            runtime_error("Undefined attribute '%s'", name->chars);
+            return false;
+        }
+        if(IS_VAR_CONST(entry->var.scope))
         {
             runtime_error("Assigning to constant attribute '%s'", name->chars);
             return false;
         }
-        hash_table_set(&instance->attributes, name, peek(0));
-        Value value = pop();
-        pop();
-        push(value);
+        cache_attr(cache, instance->klass, entry);
     }
-    else
+    // methods are always constant so entry is a field
+    instance->fields[AS_INT(entry->var.value)] = peek(0);
+    WRITE_BARRIER(instance, peek(0));
+    Value value = pop();
+    pop();
+    push(value);
+    return true;
+}
+
+static bool push_frame()
+{
+    if(vm.frame_count == vm.frame_capacity)
     {
-        runtime_error("Undefined attribute '%s'", name->chars);
-        return false;
+        size_t capacity = vm.frame_capacity * 2;
+        CallFrame* frames = (CallFrame*)realloc(vm.frames, sizeof(CallFrame) * capacity);
+        if(frames == NULL)
+        {
+            return false;
+        }
+        vm.frames = frames;
+        vm.frame_capacity = capacity;
     }
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->ret = vm.ip;
+    frame->base = (size_t)(vm.stack_base - vm.stack);
+    frame->closure = vm.closure;
     return true;
 }
 
-#undef READ_STRING
-
-static void call(ObjFunc* func)
+static bool call(ObjFunc* func, ObjClosure* closure, size_t args, size_t expected_inputs)
 {
-    vm.ip = vm.chunk->code + func->offset;
+    if(args != expected_inputs)
+    {
+        runtime_error("Expected %zu args but got %zu", expected_inputs, args);
+        return false;
+    }
+    if(!ensure_stack(func->max_stack) || !push_frame())
+    {
+        runtime_error("Stack overflow, the stack is limited to %zu bytes", vm.stack_max);
+        return false;
+    }
+    vm.stack_base = vm.stack_top - args;
+    vm.closure = closure;
+    vm.ip = vm.chunk->insts + func->entry;
+    return true;
 }
 
-static bool call_value(Value callee, size_t extra_inputs)
+// calls the callee sitting below its args arguments on the stack
+static bool call_value(Value callee, size_t args, size_t extra_inputs)
 {
+    // a bound method's method takes its slot and the reciever is pushed as the last argument, this
+    while(IS_BOUND_METHOD(callee))
+    {
+        ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+        callee = OBJ_VAL(bound->method);
+        vm.stack_top[-1 - (int64_t)args] = callee;
+        push(bound->reciever);
+        args++;
+        extra_inputs = 1;
+    }
     if(IS_OBJ(callee))
     {
         switch(OBJ_TYPE(callee))
@@ -348,65 +470,44 @@ static bool call_value(Value callee, size_t extra_inputs)
             case OBJ_FUNC:
             {
                 ObjFunc* func = AS_FUNC(callee);
-                if(!setup_call(func->num_inputs + extra_inputs))
-                {
-                    return false;
-                }
-                call(func);
-                return true;
+                return call(func, NULL, args, func->num_inputs + extra_inputs);
             }
             case OBJ_CLOSURE:
             {
-                ObjFunc* func = AS_CLOSURE(callee)->func;
-                if(!setup_call(func->num_inputs + extra_inputs))
-                {
-                    return false;
-                }
-                call(func);
-                return true;
-            }
-            case OBJ_BOUND_METHOD:
-            {
-                ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
-                push(bound->reciever);
-                return call_value(OBJ_VAL(bound->method), 1);
+                ObjClosure* closure = AS_CLOSURE(callee);
+                return call(closure->func, closure, args, closure->func->num_inputs + extra_inputs);
             }
             case OBJ_NATIVE:
             {
                 ObjNative* native = AS_NATIVE(callee);
-                if(!setup_call(native->num_inputs + extra_inputs))
+                if(args != native->num_inputs + extra_inputs)
                 {
+                    runtime_error("Expected %zu args but got %zu", native->num_inputs + extra_inputs, args);
                     return false;
                 }
-                Value ret = native->func(vm.stack_base);
-                close_func_upvalues();
-                vm.stack_top = vm.stack_base;
-                Value call_base_addr = pop();
-                Value base_addr = pop();
-                pop(); // remove return address (don't need)
-                vm.call_base = (Value*)(size_t)AS_INT(call_base_addr);
-                vm.stack_base = (Value*)(size_t)AS_INT(base_addr);
-                pop(); // remove calling function
+                Value* inputs = vm.stack_top - args;
+                // natives only see flat strings
+                for(size_t i = 0; i < args; i++)
+                {
+                    if(IS_ROPE(inputs[i]))
+                    {
+                        inputs[i] = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(inputs[i])));
+                    }
+                }
+                Value ret = native->func(inputs);
+                vm.stack_top = inputs - 1;
                 push(ret);
                 return true;
             }
             case OBJ_CLASS:
             {
                 ObjClass* klass = AS_CLASS(callee);
-                if(!setup_call(0))
+                if(args != 0)
                 {
+                    runtime_error("Expected 0 args but got %zu", args);
                     return false;
                 }
-                Value ret = OBJ_VAL((Obj*)new_instance(klass));
-                close_func_upvalues();
-                vm.stack_top = vm.stack_base;
-                Value call_base_addr = pop();
-                Value base_addr = pop();
-                pop();
-                vm.call_base = (Value*)(size_t)AS_INT(call_base_addr);
-                vm.stack_base = (Value*)(size_t)AS_INT(base_addr);
-                pop();
-                push(ret);
+                vm.stack_top[-1] = OBJ_VAL((Obj*)new_instance(klass));
                 return true;
             }
             default:
@@ -419,1363 +520,253 @@ static bool call_value(Value callee, size_t extra_inputs)
     return false;
 }
 
-static void define_attr(ObjString* name)
-{
-    Value attr = peek(0);
-    ObjClass* klass = AS_CLASS(peek(1));
-    uint8_t scope = (uint8_t)*vm.ip;
-    vm.ip++;
-    hash_table_insert(&klass->attributes, name, scope, attr);
-    pop();
-}
-
-#define READ_STRING(offset_size) AS_STRING(read_const(offset_size))
-
-static InterpretResult run()
+/* Tail call
+ * A call whose result is returned straight away reuses the frame of the function making it
+ * Its upvalues are closed and the callee and arguments slide down over its slots, so the
+ * frame's return address goes straight back to its caller and tail recursion needs no stack
+ * Natives, classes and bound methods are called as usual and returned by the OP_RETURN after
+*/
+static bool tail_call(Value callee, size_t args)
 {
-    vm.running = true;
-    for(;;)
+    ObjFunc* func = NULL;
+    ObjClosure* closure = NULL;
+    if(IS_OBJ(callee))
     {
-        vm.gc = true;
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("        ");
-        for(Value* slot = vm.stack_base; slot < vm.stack_top; slot++)
-        {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassemble_inst(vm.chunk, (size_t)(vm.ip - vm.chunk->code));
-#endif
-        inst_type inst;
-        switch(inst = READ_INST())
+        switch(OBJ_TYPE(callee))
         {
-            case OP_RETURN:
-            {
-                Value ret = pop();
-                close_func_upvalues();
-                vm.stack_top = vm.stack_base;
-                Value call_base_addr = pop();
-                Value base_addr = pop();
-                Value ret_addr = pop();
-                vm.call_base = (Value*)(size_t)AS_INT(call_base_addr);
-                vm.stack_base = (Value*)(size_t)AS_INT(base_addr);
-                vm.ip = vm.chunk->code + (size_t)AS_INT(ret_addr);
-                pop(); // remove calling function
-                push(ret);
-                break;
-            }
-            case OP_EXIT:
-            {
-                return INTERPRET_OK;
-            }
-            case OP_CONST_BYTE:
-            {
-                Value constant = read_const(1);
-                push(constant);
-                break;
-            }
-            case OP_CONST_SHORT:
-            {
-                Value constant = read_const(2);
-                push(constant);
-                break;
-            }
-            case OP_CONST_WORD:
-            {
-                Value constant = read_const(4);
-                push(constant);
-                break;
-            }
-            case OP_CONST_LONG:
-            {
-                Value constant = read_const(8);
-                push(constant);
-                break;
-            }
-            case OP_NULL:
-            {
-                push(NULL_VAL);
-                break;
-            }
-            case OP_TRUE:
-            {
-                push(BOOL_VAL(true));
-                break;
-            }
-            case OP_FALSE:
-            {
-                push(BOOL_VAL(false));
-                break;
-            }
-            case OP_NEGATE:
-            {
-                if(IS_INT(peek(0)))
-                {
-                    push(INT_VAL(-AS_INT(pop())));
-                }
-                else if(IS_FLOAT(peek(0)))
-                {
-                    push(FLOAT_VAL(-AS_FLOAT(pop())));
-                }
-                else
-                {
-                    runtime_error("Operand must be an integer or float");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_ADD:
-            {
-                if(IS_STRING(peek(0)) && IS_STRING(peek(1)))
-                {
-                    concatenate();
-                }
-                else if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a + b));
-                }
-                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a + (double)b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(FLOAT_VAL((double)a + b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a + b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers or floats");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SUB:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a - b));
-                }
-                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a - (double)b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(FLOAT_VAL((double)a - b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a - b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers or floats");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_MUL:
+            case OBJ_FUNC:
             {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a * b));
-                }
-                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a * (double)b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(FLOAT_VAL((double)a * b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a * b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers or floats");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                func = AS_FUNC(callee);
                 break;
             }
-            case OP_DIV:
+            case OBJ_CLOSURE:
             {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    if(b == 0)
-                    {
-                        runtime_error("Divide by 0 error");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(INT_VAL(a / b));
-                }
-                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a / (double)b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(FLOAT_VAL((double)a / b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(FLOAT_VAL(a / b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers or floats");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                closure = AS_CLOSURE(callee);
+                func = closure->func;
                 break;
             }
-            case OP_REM:
+            default:
             {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    if(b == 0)
-                    {
-                        runtime_error("Divide by 0 error");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(INT_VAL(a % b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
                 break;
             }
-            case OP_NOT:
-            {
-                if(IS_BOOL(peek(0)))
-                {
-                    push(BOOL_VAL(!AS_BOOL(pop())));
-                }
-                else
-                {
-                    runtime_error("Operand must be a boolean");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_BIT_NOT:
-            {
-                if(IS_INT(peek(0)))
-                {
-                    push(INT_VAL(~AS_INT(pop())));
-                }
-                else
-                {
-                    runtime_error("Operand must be an integer");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_BIT_AND:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a & b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_BIT_OR:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a | b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_BIT_XOR:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(INT_VAL(a ^ b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SHIFT_LEFT:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    if(b < 0)
-                    {
-                        runtime_error("Shift value can't be negative");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(INT_VAL(a << b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SHIFT_ARITH_RIGHT:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    if(b < 0)
-                    {
-                        runtime_error("Shift value can't be negative");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(INT_VAL(a >> b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_SHIFT_LOGIC_RIGHT:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    if(b < 0)
-                    {
-                        runtime_error("Shift value can't be negative");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    if(a < 0 && b > 0)
-                    {
-                        a &= 0x7fffffffffffffff;
-                    }
-                    push(INT_VAL(a >> b));
-                }
-                else
-                {
-                    runtime_error("Operands must be integers");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_EQL:
-            {
-                Value b = pop();
-                Value a = pop();
-                if(a.type == VAL_NULL || b.type == VAL_NULL || a.type == b.type)
-                {
-                    push(BOOL_VAL(values_eql(a, b)));
-                }
-                else
-                {
-                    runtime_error("Operands must be the same type");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_GREATER:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(BOOL_VAL(a > b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(BOOL_VAL(a > b));
-                }
-                else
-                {
-                    runtime_error("Operands must be the same type and a number");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_LESS:
-            {
-                if(IS_INT(peek(0)) && IS_INT(peek(1)))
-                {
-                    int64_t b = AS_INT(pop());
-                    int64_t a = AS_INT(pop());
-                    push(BOOL_VAL(a < b));
-                }
-                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
-                {
-                    double b = AS_FLOAT(pop());
-                    double a = AS_FLOAT(pop());
-                    push(BOOL_VAL(a < b));
-                }
-                else
-                {
-                    runtime_error("Operands must be the same type and a number");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_CAST_BOOL:
-            {
-                Value val = pop();
-                switch(val.type)
-                {
-                    case VAL_BOOL:
-                    {
-                        push(val);
-                        break;
-                    }
-                    case VAL_NULL:
-                    {
-                        push(BOOL_VAL(false));
-                        break;
-                    }
-                    case VAL_INT:
-                    {
-                        push(BOOL_VAL(AS_INT(val) != 0));
-                        break;
-                    }
-                    case VAL_FLOAT:
-                    {
-                        push(BOOL_VAL(AS_FLOAT(val) != 0.0));
-                        break;
-                    }
-                    case VAL_OBJ:
-                    {
-                        switch(OBJ_TYPE(val))
-                        {
-                            case OBJ_STRING:
-                            {
-                                if(AS_STRING(val)->len == 4 && memcmp(AS_CSTRING(val), "true", 4) == 0)
-                                {
-                                    push(BOOL_VAL(true));
-                                }
-                                else if(AS_STRING(val)->len == 5 && memcmp(AS_CSTRING(val), "false", 5) == 0)
-                                {
-                                    push(BOOL_VAL(false));
-                                }
-                                else
-                                {
-                                    runtime_error("Cannot cast '%s' to bool", AS_CSTRING(val));
-                                    return INTERPRET_RUNTIME_ERROR;
-                                }
-                                break;
-                            }
-                            default:
-                            {
-                                push(BOOL_VAL(true));
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    default:
-                    {
-                        runtime_error("Unknown type");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                }
-                break;
-            }
-            case OP_CAST_INT:
-            {
-                Value val = pop();
-                switch(val.type)
-                {
-                    case VAL_BOOL:
-                    {
-                        push(INT_VAL(AS_BOOL(val) ? 1 : 0));
-                        break;
-                    }
-                    case VAL_NULL:
-                    {
-                        push(INT_VAL(0));
-                        break;
-                    }
-                    case VAL_INT:
-                    {
-                        push(val);
-                        break;
-                    }
-                    case VAL_FLOAT:
-                    {
-                        push(INT_VAL((int64_t)AS_FLOAT(val)));
-                        break;
-                    }
-                    case VAL_OBJ:
-                    {
-                        switch(OBJ_TYPE(val))
-                        {
-                            case OBJ_STRING:
-                            {
-                                int64_t int_val = 0;
-                                if(!str_to_int(&int_val, AS_CSTRING(val), AS_STRING(val)->len))
-                                {
-                                    runtime_error("Cannot cast '%s' to int", AS_CSTRING(val));
-                                    return INTERPRET_RUNTIME_ERROR;
-                                }
-                                push(INT_VAL(int_val));
-                                break;
-                            }
-                            default:
-                            {
-                                runtime_error("Unsupported conversion of object to int");
-                                return INTERPRET_RUNTIME_ERROR;
-                            }
-                        }
-                        break;
-                    }
-                    default:
-                    {
-                        runtime_error("Unknown type");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                }
-                break;
-            }
-            case OP_CAST_STR:
-            {
-                Value val = pop();
-                push(OBJ_VAL((Obj*)value_to_str(val)));
-                break;
-            }
-            case OP_CAST_FLOAT:
-            {
-                Value val = pop();
-                switch(val.type)
-                {
-                    case VAL_BOOL:
-                    {
-                        push(FLOAT_VAL(AS_BOOL(val) ? 1.0 : 0.0));
-                        break;
-                    }
-                    case VAL_NULL:
-                    {
-                        push(FLOAT_VAL(0.0));
-                        break;
-                    }
-                    case VAL_INT:
-                    {
-                        push(FLOAT_VAL((double)AS_INT(val)));
-                        break;
-                    }
-                    case VAL_FLOAT:
-                    {
-                        push(val);
-                        break;
-                    }
-                    case VAL_OBJ:
-                    {
-                        switch(OBJ_TYPE(val))
-                        {
-                            case OBJ_STRING:
-                            {
-                                double float_val = 0;
-                                if(!str_to_float(&float_val, AS_CSTRING(val), AS_STRING(val)->len))
-                                {
-                                    runtime_error("Cannot cast '%s' to float", AS_CSTRING(val));
-                                    return INTERPRET_RUNTIME_ERROR;
-                                }
-                                push(FLOAT_VAL(float_val));
-                                break;
-                            }
-                            default:
-                            {
-                                runtime_error("Unsupported conversion of object to float");
-                                return INTERPRET_RUNTIME_ERROR;
-                            }
-                        }
-                        break;
-                    }
-                    default:
-                    {
-                        runtime_error("Unknown type");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                }
-                break;
-            }
-            case OP_POP:
-            {
-                pop();
-                break;
-            }
-            case OP_CLOSE_UPVALUE:
-            {
-                close_upvalue();
-                pop();
-                break;
-            }
-            case OP_GET_GLOBAL_BYTE:
-            {
-                Value value = read_global(1);
-                push(value);
-                break;
-            }
-            case OP_GET_GLOBAL_SHORT:
-            {
-                Value value = read_global(2);
-                push(value);
-                break;
-            }
-            case OP_GET_GLOBAL_WORD:
-            {
-                Value value = read_global(4);
-                push(value);
-                break;
-            }
-            case OP_GET_GLOBAL_LONG:
-            {
-                Value value = read_global(8);
-                push(value);
-                break;
-            }
-            case OP_SET_GLOBAL_BYTE:
-            {
-                Value value = peek(0);
-                write_global(1, value);
-                break;
-            }
-            case OP_SET_GLOBAL_SHORT:
-            {
-                Value value = peek(0);
-                write_global(2, value);
-                break;
-            }
-            case OP_SET_GLOBAL_WORD:
-            {
-                Value value = peek(0);
-                write_global(4, value);
-                break;
-            }
-            case OP_SET_GLOBAL_LONG:
-            {
-                Value value = peek(0);
-                write_global(8, value);
-                break;
-            }
-            case OP_GET_UPVALUE_BYTE:
-            {
-                size_t slot = read_inst_index(1);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                push(*closure->upvalues[slot].upvalue->value);
-                break;
-            }
-            case OP_GET_UPVALUE_SHORT:
-            {
-                size_t slot = read_inst_index(2);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                push(*closure->upvalues[slot].upvalue->value);
-                break;
-            }
-            case OP_GET_UPVALUE_WORD:
-            {
-                size_t slot = read_inst_index(4);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                push(*closure->upvalues[slot].upvalue->value);
-                break;
-            }
-            case OP_GET_UPVALUE_LONG:
-            {
-                size_t slot = read_inst_index(8);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                push(*closure->upvalues[slot].upvalue->value);
-                break;
-            }
-            case OP_SET_UPVALUE_BYTE:
-            {
-                size_t slot = read_inst_index(1);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                Value value = peek(0);
-                *closure->upvalues[slot].upvalue->value = value;
-                break;
-            }
-            case OP_SET_UPVALUE_SHORT:
-            {
-                size_t slot = read_inst_index(2);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                Value value = peek(0);
-                *closure->upvalues[slot].upvalue->value = value;
-                break;
-            }
-            case OP_SET_UPVALUE_WORD:
-            {
-                size_t slot = read_inst_index(4);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                Value value = peek(0);
-                *closure->upvalues[slot].upvalue->value = value;
-                break;
-            }
-            case OP_SET_UPVALUE_LONG:
-            {
-                size_t slot = read_inst_index(8);
-                ObjClosure* closure = AS_CLOSURE(vm.stack_base[-4]);
-                Value value = peek(0);
-                *closure->upvalues[slot].upvalue->value = value;
-                break;
-            }
-            case OP_GET_LOCAL_BYTE:
-            {
-                size_t slot = read_inst_index(1);
-                push(vm.stack_base[slot]);
-                break;
-            }
-            case OP_GET_LOCAL_SHORT:
-            {
-                size_t slot = read_inst_index(2);
-                push(vm.stack_base[slot]);
-                break;
-            }
-            case OP_GET_LOCAL_WORD:
-            {
-                size_t slot = read_inst_index(4);
-                push(vm.stack_base[slot]);
-                break;
-            }
-            case OP_GET_LOCAL_LONG:
-            {
-                size_t slot = read_inst_index(8);
-                push(vm.stack_base[slot]);
-                break;
-            }
-            case OP_SET_LOCAL_BYTE:
-            {
-                size_t slot = read_inst_index(1);
-                vm.stack_base[slot] = peek(0);
-                break;
-            }
-            case OP_SET_LOCAL_SHORT:
-            {
-                size_t slot = read_inst_index(2);
-                vm.stack_base[slot] = peek(0);
-                break;
-            }
-            case OP_SET_LOCAL_WORD:
-            {
-                size_t slot = read_inst_index(4);
-                vm.stack_base[slot] = peek(0);
-                break;
-            }
-            case OP_SET_LOCAL_LONG:
-            {
-                size_t slot = read_inst_index(8);
-                vm.stack_base[slot] = peek(0);
-                break;
-            }
-            case OP_JUMP_IF_FALSE_BYTE:
-            {
-                size_t offset = read_jump(1);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == false)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_FALSE_SHORT:
-            {
-                size_t offset = read_jump(2);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == false)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_FALSE_WORD:
-            {
-                size_t offset = read_jump(4);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == false)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_FALSE_LONG:
-            {
-                size_t offset = read_jump(8);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == false)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_TRUE_BYTE:
-            {
-                size_t offset = read_jump(1);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == true)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_TRUE_SHORT:
-            {
-                size_t offset = read_jump(2);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == true)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_TRUE_WORD:
-            {
-                size_t offset = read_jump(4);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == true)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_TRUE_LONG:
-            {
-                size_t offset = read_jump(8);
-                if(!IS_BOOL(peek(0)))
-                {
-                    runtime_error("Condition expression is not boolean");
-                }
-                if(AS_BOOL(peek(0)) == true)
-                {
-                    vm.ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_BYTE:
-            {
-                size_t offset = read_jump(1);
-                vm.ip += offset;
-                break;
-            }
-            case OP_JUMP_SHORT:
-            {
-                size_t offset = read_jump(2);
-                vm.ip += offset;
-                break;
-            }
-            case OP_JUMP_WORD:
-            {
-                size_t offset = read_jump(4);
-                vm.ip += offset;
-                break;
-            }
-            case OP_JUMP_LONG:
-            {
-                size_t offset = read_jump(8);
-                vm.ip += offset;
-                break;
-            }
-            case OP_JUMP_BACK_BYTE:
-            {
-                size_t offset = read_jump(1);
-                vm.ip -= offset;
-                break;
-            }
-            case OP_JUMP_BACK_SHORT:
-            {
-                size_t offset = read_jump(2);
-                vm.ip -= offset;
-                break;
-            }
-            case OP_JUMP_BACK_WORD:
-            {
-                size_t offset = read_jump(4);
-                vm.ip -= offset;
-                break;
-            }
-            case OP_JUMP_BACK_LONG:
-            {
-                size_t offset = read_jump(8);
-                vm.ip -= offset;
-                break;
-            }
-            case OP_INIT_ARRAY:
-            {
-                if(!IS_INT(peek(0)))
-                {
-                    runtime_error("Must have integer size for array");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(AS_INT(peek(0)) <= 0)
-                {
-                    runtime_error("Array size must be greater than 0");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                Value size = pop();
-                Value val = pop();
-                push(OBJ_VAL((Obj*)build_array(AS_INT(size), val)));
-                break;
-            }
-            case OP_FILL_ARRAY:
-            {
-                if(!IS_INT(peek(0)))
-                {
-                    runtime_error("Must have integer size for array");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(AS_INT(peek(0)) <= 0)
-                {
-                    runtime_error("Array size must be greater than 0");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                Value size = pop();
-                ObjArray* array = build_array(AS_INT(size), NULL_VAL);
-                for(size_t i = AS_INT(size); i > 0; i--)
-                {
-                    array->data[i - 1] = pop();
-                }
-                push(OBJ_VAL((Obj*)array));
-                break;
-            }
-            case OP_INDEX_GET:
-            {
-                if(!IS_ARRAY(peek(1)) && !IS_STRING(peek(1)))
-                {
-                    runtime_error("Cannot index value");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(!IS_INT(peek(0)))
-                {
-                    runtime_error("Must have integer index");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(AS_INT(peek(0)) < 0)
-                {
-                    runtime_error("Index can't be negative");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                Value index = pop();
-                Value array = pop();
-                if(IS_ARRAY(array))
-                {
-                    if(AS_INT(index) >= AS_ARRAY(array)->len)
-                    {
-                        runtime_error("Index is beyond array's bounds");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(AS_CARRAY(array)[AS_INT(index)]);
-                }
-                else
-                {
-                    if(AS_INT(index) >= AS_STRING(array)->len)
-                    {
-                        runtime_error("Index is beyond string's bounds");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    char c = AS_CSTRING(array)[AS_INT(index)];
-                    char* letter = ALLOCATE(char, 1);
-                    *letter = c;
-                    push(OBJ_VAL((Obj*)take_str(letter, 1)));
-                }
-                break;
-            }
-            case OP_INDEX_PEEK:
-            {
-                if(!IS_ARRAY(peek(1))) 
-                {
-                    runtime_error("Cannot index value");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(!IS_INT(peek(0)))
-                {
-                    runtime_error("Must have integer index");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(AS_INT(peek(0)) < 0)
-                {
-                    runtime_error("Index can't be negative");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                Value index = peek(0);
-                Value array = peek(1);
-                push(AS_CARRAY(array)[AS_INT(index)]);
-                break;
-            }
-            case OP_INDEX_SET:
-            {
-                if(!IS_ARRAY(peek(2)))
-                {
-                    runtime_error("Cannot index value");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(!IS_INT(peek(1)))
-                {
-                    runtime_error("Must have integer index");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if(AS_INT(peek(1)) < 0)
-                {
-                    runtime_error("Index can't be negative");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                Value val = pop();
-                Value index = pop();
-                Value array = pop();
-                if(AS_INT(index) >= AS_ARRAY(array)->len)
-                {
-                    runtime_error("Index is beyond value's bounds");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                AS_CARRAY(array)[AS_INT(index)] = val;
-                push(array);
-                break;
-            }
-            case OP_CALL:
-            {
-                if(!call_value(vm.call_base[-4], 0))
-                {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
-            }
-            case OP_PUSH_CALL_BASE:
-            {
-                push(NULL_VAL);
-                push(INT_VAL((int64_t)(size_t)(vm.stack_base)));
-                push(INT_VAL((int64_t)(size_t)(vm.call_base)));
-                vm.call_base = vm.stack_top;
-                break;
-            }
-            case OP_CLOSURE_BYTE:
-            {
-                ObjClosure* closure = AS_CLOSURE(read_const(1));
-                init_closure(closure);
-                push(OBJ_VAL((Obj*)closure));
-                break;
-            }
-            case OP_CLOSURE_SHORT:
-            {
-                ObjClosure* closure = AS_CLOSURE(read_const(2));
-                init_closure(closure);
-                push(OBJ_VAL((Obj*)closure));
-                break;
-            }
-            case OP_CLOSURE_WORD:
-            {
-                ObjClosure* closure = AS_CLOSURE(read_const(4));
-                init_closure(closure);
-                push(OBJ_VAL((Obj*)closure));
-                break;
-            }
-            case OP_CLOSURE_LONG:
-            {
-                ObjClosure* closure = AS_CLOSURE(read_const(8));
-                init_closure(closure);
-                push(OBJ_VAL((Obj*)closure));
-                break;
-            }
-            case OP_ATTR_BYTE:
-            {
-                define_attr(READ_STRING(1));
-                break;
-            }
-            case OP_ATTR_SHORT:
-            {
-                define_attr(READ_STRING(2));
-                break;
-            }
-            case OP_ATTR_WORD:
-            {
-                define_attr(READ_STRING(4));
-                break;
-            }
-            case OP_ATTR_LONG:
-            {
-                define_attr(READ_STRING(8));
-                break;
-            }
-            case OP_ATTR_GET_BYTE:
-            {
-                if(get_attr(1, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_SHORT:
-            {
-                if(get_attr(2, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_WORD:
-            {
-                if(get_attr(4, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_LONG:
-            {
-                if(get_attr(8, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_BYTE:
-            {
-                if(get_attr(1, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_SHORT:
-            {
-                if(get_attr(2, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_WORD:
-            {
-                if(get_attr(4, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_LONG:
-            {
-                if(get_attr(8, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_BYTE:
-            {
-                if(set_attr(1))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_SHORT:
-            {
-                if(set_attr(2))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_WORD:
-            {
-                if(set_attr(4))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_LONG:
-            {
-                if(set_attr(8))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_THIS_BYTE:
-            {
-                if(get_this_attr(1, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_THIS_SHORT:
-            {
-                if(get_this_attr(2, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_THIS_WORD:
-            {
-                if(get_this_attr(4, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_GET_THIS_LONG:
-            {
-                if(get_this_attr(8, true))
-                {
-                    break;    
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_THIS_BYTE:
-            {
-                if(get_this_attr(1, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_THIS_SHORT:
-            {
-                if(get_this_attr(2, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_THIS_WORD:
-            {
-                if(get_this_attr(4, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_PEEK_THIS_LONG:
-            {
-                if(get_this_attr(8, false))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_THIS_BYTE:
-            {
-                if(set_this_attr(1))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_THIS_SHORT:
-            {
-                if(set_this_attr(2))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_THIS_WORD:
-            {
-                if(set_this_attr(4))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            case OP_ATTR_SET_THIS_LONG:
-            {
-                if(set_this_attr(8))
-                {
-                    break;
-                }
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            default:
-            {
-                runtime_error("Unknown instruction %u", inst);
-                return INTERPRET_RUNTIME_ERROR;
-            }
         }
     }
-    vm.running = false;
+    if(func == NULL)
+    {
+        return call_value(callee, args, 0);
+    }
+    if(args != func->num_inputs)
+    {
+        runtime_error("Expected %zu args but got %zu", func->num_inputs, args);
+        return false;
+    }
+    close_func_upvalues();
+    memmove(vm.stack_base + STACK_CALLER, vm.stack_top - 1 - args, sizeof(Value) * (args + 1));
+    vm.stack_top = vm.stack_base + args;
+    if(!ensure_stack(func->max_stack))
+    {
+        runtime_error("Stack overflow, the stack is limited to %zu bytes", vm.stack_max);
+        return false;
+    }
+    vm.closure = closure;
+    vm.ip = vm.chunk->insts + func->entry;
+    return true;
+}
+
+/* Method invoke
+ * The reciever sits in the callee slot below the arguments
+ * A method replaces it there and the reciever is pushed as the last argument, this,
+ * as calling a bound method would do, but without allocating one
+ * Fields holding something callable are called like OP_ATTR_GET followed by OP_CALL
+*/
+static bool invoke(ObjString* name, AttrCache* cache, bool this_call, size_t args)
+{
+    Value* callee = vm.stack_top - 1 - args;
+    Value reciever = *callee;
+    if(!IS_INSTANCE(reciever))
+    {
+        runtime_error("Only instances have attributes");
+        return false;
+    }
+    ObjInstance* instance = AS_INSTANCE(reciever);
+    Entry* entry = find_cached_attr(cache, instance->klass, name);
+    if(entry == NULL)
+    {
+        entry = hash_table_get_entry(&instance->klass->attributes, name);
+        if(entry == NULL)
+        {
+            runtime_error("Undefined attribute '%s'", name->chars);
+            return false;
+        }
+        if(!this_call && !IS_VAR_PUB(entry->var.scope))
+        {
+            runtime_error("Trying to access non public attribute '%s'", name->chars);
+            return false;
+        }
+        cache_attr(cache, instance->klass, entry);
+    }
+    if(IS_VAR_METHOD(entry->var.scope))
+    {
+        *callee = entry->var.value;
+        push(reciever);
+        return call_value(entry->var.value, args + 1, 1);
+    }
+    Value field = instance->fields[AS_INT(entry->var.value)];
+    *callee = field;
+    return call_value(field, args, 0);
+}
+
+static void define_attr(ObjString* name, uint8_t scope)
+{
+    Value attr = peek(0);
+    ObjClass* klass = AS_CLASS(peek(1));
+    WRITE_BARRIER(klass, attr);
+    if(IS_VAR_METHOD(scope))
+    {
+        hash_table_insert(&klass->attributes, name, scope, attr);
+    }
+    else if(hash_table_insert(&klass->attributes, name, scope, INT_VAL(klass->fields.size)))
+    {
+        write_value_array(&klass->fields, attr);
+    }
+    pop();
+}
+
+#define READ_STRING(index) AS_STRING(vm.chunk->consts.values[index])
+#define READ_CACHE() (&vm.chunk->attr_caches[inst->cache])
+
+#define REG_READ(src) ((src) & REG_CONST ? vm.chunk->consts.values[(src) & REG_MAX] : slots[src])
+// stores the result of a register op and skips the rest of its sequence
+#define REG_WRITE(value) \
+{ \
+    size_t dst = REG_DST(inst); \
+    if(dst == REG_PUSH) \
+    { \
+        push(value); \
+        ip += 2; \
+    } \
+    else \
+    { \
+        slots[dst] = value; \
+        ip += 4; \
+    } \
+}
+
+// a full collection could not bring the old space under gc_config.max_heap
+#define HEAP_LIMIT_ERROR() \
+{ \
+    runtime_error("Heap limit of %zu bytes exceeded", vm.gc_config.max_heap); \
+    return INTERPRET_RUNTIME_ERROR; \
+}
+
+/* Safe points
+ * Allocation only flags that a collection is due, the loop runs it at the next safe point
+ * Calls, returns and backward jumps are safe points, so every loop and recursion reaches one,
+ * as are the ops that allocate, so straight line code between them allocates a bounded amount
+*/
+#define SAFE_POINT() \
+{ \
+    if(vm.gc_pending) \
+    { \
+        if(!collect_garbage()) \
+        { \
+            HEAP_LIMIT_ERROR(); \
+        } \
+    } \
+}
+
+/* Dispatch
+ * With COMPUTED_GOTO each handler ends by jumping straight to the handler of the next
+ * instruction through dispatch_table, giving every opcode its own indirect branch
+ * instead of sharing the single one at the top of the switch
+ * Without it the portable switch loop is used
+*/
+#ifdef COMPUTED_GOTO
+#define VM_CASE(op) label_##op:
+#define VM_DEFAULT label_unknown:
+#define DISPATCH() \
+{ \
+    TRACE_INST(); \
+    inst = READ_INST(); \
+    goto *inst->handler; \
+}
+#define VM_BREAK DISPATCH()
+#define QUICKEN(new_op) \
+{ \
+    inst->op = new_op; \
+    inst->handler = dispatch_table[new_op]; \
+}
+#else
+#define VM_CASE(op) case op:
+#define VM_DEFAULT default:
+#define VM_BREAK break
+#define QUICKEN(new_op) \
+{ \
+    inst->op = new_op; \
+}
+#endif
+
+/* Quickening
+ * The generic arithmetic and comparison handlers rewrite their instruction to a type specialised
+ * variant once they see int/int or float/float operands, so later runs take a single type check
+ * A specialised handler whose guard fails turns the instruction back into the generic op
+ * and runs it again, which handles mixed types, strings and errors
+*/
+#define DEQUICKEN(generic_op) \
+{ \
+    QUICKEN(generic_op); \
+    ip--; \
+    VM_BREAK; \
+}
+
+#define TRACE_INST()
+#define RUN_LOOP run
+#include "vm_loop.h"
+#undef RUN_LOOP
+#undef TRACE_INST
+
+/* Tracing
+ * --trace and --count-dispatch select run_traced, a second copy of the loop which counts
+ * the instructions it dispatches or prints the stack and the next instruction, so run
+ * itself has no per instruction debug checks
+ */
+#define TRACE_INST() \
+{ \
+    if(vm.count_dispatch) \
+    { \
+        vm.dispatch_count++; \
+    } \
+    if(vm.trace_execution) \
+    { \
+        printf("        "); \
+        for(Value* slot = vm.stack_base; slot < vm.stack_top; slot++) \
+        { \
+            printf("[ "); \
+            print_value(*slot); \
+            printf(" ]"); \
+        } \
+        printf("\n"); \
+        disassemble_inst(vm.chunk, ip->offset); \
+    } \
 }
+#define RUN_LOOP run_traced
+#include "vm_loop.h"
+#undef RUN_LOOP
 #undef READ_INST
 #undef READ_STRING
+#undef READ_CACHE
+#undef REG_READ
+#undef REG_WRITE
+#undef TRACE_INST
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_BREAK
+#undef QUICKEN
+#undef DEQUICKEN
+#undef SAFE_POINT
+#ifdef COMPUTED_GOTO
+#undef DISPATCH
+#endif
 
 InterpretResult interpret(const char* src, HashTable* global_names, Chunk* main_chunk)
 {
@@ -1795,20 +786,26 @@ InterpretResult interpret(const char* src, HashTable* global_names, Chunk* main_
         free_chunk(&chunk);
         return INTERPRET_COMPILE_ERROR;
     }
-    vm.ip = vm.chunk->code + vm.chunk->entry;
+    decode_chunk(vm.chunk);
+    vm.ip = vm.chunk->insts + get_inst_index(vm.chunk, vm.chunk->entry);
+    if(!ensure_stack(STACK_SLOTS_PER_BYTE * (vm.chunk->size - vm.chunk->entry)))
+    {
+        fprintf(stderr, "Stack limit of %zu bytes is too small for the script\n", vm.stack_max);
+        free_chunk(&chunk);
+        return INTERPRET_RUNTIME_ERROR;
+    }
 
-    InterpretResult res = run();
+    InterpretResult res = vm.trace_execution || vm.count_dispatch ? run_traced() : run();
+    // runtime errors return from run directly
+    vm.running = false;
+    minor_collect();
     free_chunk(&chunk);
     return res;
 }
 
+// room is made when a function is called, see ensure_stack
 void push(Value value)
 {
-    if(vm.stack_top >= vm.stack + STACK_MAX)
-    {
-        runtime_error("Stack Overflow - please report on stackoverflow.com");
-        return;
-    }
     *vm.stack_top = value;
     vm.stack_top++;
 }
@@ -1831,5 +828,23 @@ void free_vm()
     vm.gray_size = 0;
     vm.gray_capacity = 0;
     vm.gray_stack = NULL;
+    free(vm.remembered);
+    vm.remembered_size = 0;
+    vm.remembered_capacity = 0;
+    vm.remembered = NULL;
+    free(vm.promoted);
+    vm.promoted_size = 0;
+    vm.promoted_capacity = 0;
+    vm.promoted = NULL;
+    free(vm.stack);
+    vm.stack = NULL;
+    vm.stack_capacity = 0;
+    free(vm.frames);
+    vm.frames = NULL;
+    vm.frame_capacity = 0;
+    free(vm.nursery);
+    vm.nursery = NULL;
+    vm.nursery_top = NULL;
+    vm.nursery_end = NULL;
     free_objs();
 }
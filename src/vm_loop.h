@@ -0,0 +1,1413 @@
+/* Interpreter loop
+ * Included by vm.c once for each dispatch loop, RUN_LOOP names the function and
+ * TRACE_INST is what runs before each instruction, nothing at all in run
+ */
+static InterpretResult RUN_LOOP()
+{
+    vm.running = true;
+    Inst* inst;
+    // registers for vm.ip, vm.stack_base and vm.closure, reloaded after anything that calls or returns
+    Inst* ip = vm.ip;
+    Value* slots = vm.stack_base;
+    ObjClosure* closure = vm.closure;
+#ifdef COMPUTED_GOTO
+    static void* dispatch_table[1 << (sizeof(inst_type) * 8)] = {
+        [0 ... (1 << (sizeof(inst_type) * 8)) - 1] = &&label_unknown,
+        [OP_RETURN] = &&label_OP_RETURN,
+        [OP_EXIT] = &&label_OP_EXIT,
+        [OP_CONST] = &&label_OP_CONST,
+        [OP_NULL] = &&label_OP_NULL,
+        [OP_TRUE] = &&label_OP_TRUE,
+        [OP_FALSE] = &&label_OP_FALSE,
+        [OP_NEGATE] = &&label_OP_NEGATE,
+        [OP_ADD] = &&label_OP_ADD,
+        [OP_SUB] = &&label_OP_SUB,
+        [OP_MUL] = &&label_OP_MUL,
+        [OP_DIV] = &&label_OP_DIV,
+        [OP_REM] = &&label_OP_REM,
+        [OP_NOT] = &&label_OP_NOT,
+        [OP_BIT_NOT] = &&label_OP_BIT_NOT,
+        [OP_BIT_AND] = &&label_OP_BIT_AND,
+        [OP_BIT_OR] = &&label_OP_BIT_OR,
+        [OP_BIT_XOR] = &&label_OP_BIT_XOR,
+        [OP_SHIFT_LEFT] = &&label_OP_SHIFT_LEFT,
+        [OP_SHIFT_ARITH_RIGHT] = &&label_OP_SHIFT_ARITH_RIGHT,
+        [OP_SHIFT_LOGIC_RIGHT] = &&label_OP_SHIFT_LOGIC_RIGHT,
+        [OP_EQL] = &&label_OP_EQL,
+        [OP_GREATER] = &&label_OP_GREATER,
+        [OP_LESS] = &&label_OP_LESS,
+        [OP_ADD_INT_INT] = &&label_OP_ADD_INT_INT,
+        [OP_ADD_FLOAT_FLOAT] = &&label_OP_ADD_FLOAT_FLOAT,
+        [OP_SUB_INT_INT] = &&label_OP_SUB_INT_INT,
+        [OP_SUB_FLOAT_FLOAT] = &&label_OP_SUB_FLOAT_FLOAT,
+        [OP_MUL_INT_INT] = &&label_OP_MUL_INT_INT,
+        [OP_MUL_FLOAT_FLOAT] = &&label_OP_MUL_FLOAT_FLOAT,
+        [OP_DIV_INT_INT] = &&label_OP_DIV_INT_INT,
+        [OP_DIV_FLOAT_FLOAT] = &&label_OP_DIV_FLOAT_FLOAT,
+        [OP_GREATER_INT_INT] = &&label_OP_GREATER_INT_INT,
+        [OP_GREATER_FLOAT_FLOAT] = &&label_OP_GREATER_FLOAT_FLOAT,
+        [OP_LESS_INT_INT] = &&label_OP_LESS_INT_INT,
+        [OP_LESS_FLOAT_FLOAT] = &&label_OP_LESS_FLOAT_FLOAT,
+        [OP_INC_LOCAL] = &&label_OP_INC_LOCAL,
+        [OP_INC_GLOBAL] = &&label_OP_INC_GLOBAL,
+        [OP_LOCAL_LESS_CONST_JUMP_IF_FALSE] = &&label_OP_LOCAL_LESS_CONST_JUMP_IF_FALSE,
+        [OP_LOCAL_LESS_EQL_CONST_JUMP_IF_FALSE] = &&label_OP_LOCAL_LESS_EQL_CONST_JUMP_IF_FALSE,
+        [OP_SET_LOCAL_POP] = &&label_OP_SET_LOCAL_POP,
+        [OP_SET_GLOBAL_POP] = &&label_OP_SET_GLOBAL_POP,
+        [OP_REG_ADD] = &&label_OP_REG_ADD,
+        [OP_REG_SUB] = &&label_OP_REG_SUB,
+        [OP_REG_MUL] = &&label_OP_REG_MUL,
+        [OP_REG_EQL] = &&label_OP_REG_EQL,
+        [OP_REG_LESS] = &&label_OP_REG_LESS,
+        [OP_REG_GREATER] = &&label_OP_REG_GREATER,
+        [OP_CAST_BOOL] = &&label_OP_CAST_BOOL,
+        [OP_CAST_INT] = &&label_OP_CAST_INT,
+        [OP_CAST_STR] = &&label_OP_CAST_STR,
+        [OP_CAST_FLOAT] = &&label_OP_CAST_FLOAT,
+        [OP_POP] = &&label_OP_POP,
+        [OP_CLOSE_UPVALUE] = &&label_OP_CLOSE_UPVALUE,
+        [OP_GET_GLOBAL] = &&label_OP_GET_GLOBAL,
+        [OP_SET_GLOBAL] = &&label_OP_SET_GLOBAL,
+        [OP_GET_UPVALUE] = &&label_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&label_OP_SET_UPVALUE,
+        [OP_GET_LOCAL] = &&label_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&label_OP_SET_LOCAL,
+        [OP_JUMP_IF_FALSE] = &&label_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&label_OP_JUMP_IF_TRUE,
+        [OP_JUMP] = &&label_OP_JUMP,
+        [OP_INIT_ARRAY] = &&label_OP_INIT_ARRAY,
+        [OP_FILL_ARRAY] = &&label_OP_FILL_ARRAY,
+        [OP_INDEX_GET] = &&label_OP_INDEX_GET,
+        [OP_INDEX_PEEK] = &&label_OP_INDEX_PEEK,
+        [OP_INDEX_SET] = &&label_OP_INDEX_SET,
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_TAIL_CALL] = &&label_OP_TAIL_CALL,
+        [OP_INVOKE] = &&label_OP_INVOKE,
+        [OP_INVOKE_THIS] = &&label_OP_INVOKE_THIS,
+        [OP_CLOSURE] = &&label_OP_CLOSURE,
+        [OP_ATTR] = &&label_OP_ATTR,
+        [OP_ATTR_GET] = &&label_OP_ATTR_GET,
+        [OP_ATTR_PEEK] = &&label_OP_ATTR_PEEK,
+        [OP_ATTR_SET] = &&label_OP_ATTR_SET,
+        [OP_ATTR_GET_THIS] = &&label_OP_ATTR_GET_THIS,
+        [OP_ATTR_PEEK_THIS] = &&label_OP_ATTR_PEEK_THIS,
+        [OP_ATTR_SET_THIS] = &&label_OP_ATTR_SET_THIS,
+        [OP_BUILD_STRING] = &&label_OP_BUILD_STRING,
+    };
+    for(size_t i = 0; i < vm.chunk->insts_size; i++)
+    {
+        vm.chunk->insts[i].handler = dispatch_table[vm.chunk->insts[i].op];
+    }
+    DISPATCH();
+#else
+    for(;;)
+    {
+        TRACE_INST();
+        inst = READ_INST();
+        switch(inst->op)
+        {
+#endif
+            VM_CASE(OP_RETURN)
+            {
+                Value ret = pop();
+                close_func_upvalues();
+                // drop the locals, arguments and callee
+                vm.stack_top = slots + STACK_CALLER;
+                CallFrame* frame = &vm.frames[--vm.frame_count];
+                slots = vm.stack + frame->base;
+                vm.stack_base = slots;
+                closure = frame->closure;
+                vm.closure = closure;
+                ip = frame->ret;
+                push(ret);
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_EXIT)
+            {
+                return INTERPRET_OK;
+            }
+            VM_CASE(OP_CONST)
+            {
+                push(vm.chunk->consts.values[inst->arg]);
+                VM_BREAK;
+            }
+            VM_CASE(OP_NULL)
+            {
+                push(NULL_VAL);
+                VM_BREAK;
+            }
+            VM_CASE(OP_TRUE)
+            {
+                push(BOOL_VAL(true));
+                VM_BREAK;
+            }
+            VM_CASE(OP_FALSE)
+            {
+                push(BOOL_VAL(false));
+                VM_BREAK;
+            }
+            VM_CASE(OP_NEGATE)
+            {
+                if(IS_INT(peek(0)))
+                {
+                    push(INT_VAL(-AS_INT(pop())));
+                }
+                else if(IS_FLOAT(peek(0)))
+                {
+                    push(FLOAT_VAL(-AS_FLOAT(pop())));
+                }
+                else
+                {
+                    runtime_error("Operand must be an integer or float");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_ADD)
+            {
+                if(IS_TEXT(peek(0)) && IS_TEXT(peek(1)))
+                {
+                    concatenate();
+                    SAFE_POINT();
+                }
+                else if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_ADD_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a + b));
+                }
+                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a + (double)b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
+                {
+                    double b = AS_FLOAT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(FLOAT_VAL((double)a + b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_ADD_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a + b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers or floats");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_SUB)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_SUB_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a - b));
+                }
+                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a - (double)b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
+                {
+                    double b = AS_FLOAT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(FLOAT_VAL((double)a - b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_SUB_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a - b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers or floats");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_MUL)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_MUL_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a * b));
+                }
+                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a * (double)b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
+                {
+                    double b = AS_FLOAT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(FLOAT_VAL((double)a * b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_MUL_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a * b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers or floats");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_DIV)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_DIV_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    if(b == 0)
+                    {
+                        runtime_error("Divide by 0 error");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(INT_VAL(a / b));
+                }
+                else if(IS_INT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a / (double)b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_INT(peek(1)))
+                {
+                    double b = AS_FLOAT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(FLOAT_VAL((double)a / b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_DIV_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(FLOAT_VAL(a / b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers or floats");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_REM)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    if(b == 0)
+                    {
+                        runtime_error("Divide by 0 error");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(INT_VAL(a % b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_NOT)
+            {
+                if(IS_BOOL(peek(0)))
+                {
+                    push(BOOL_VAL(!AS_BOOL(pop())));
+                }
+                else
+                {
+                    runtime_error("Operand must be a boolean");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_BIT_NOT)
+            {
+                if(IS_INT(peek(0)))
+                {
+                    push(INT_VAL(~AS_INT(pop())));
+                }
+                else
+                {
+                    runtime_error("Operand must be an integer");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_BIT_AND)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a & b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_BIT_OR)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a | b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_BIT_XOR)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(INT_VAL(a ^ b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_SHIFT_LEFT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    if(b < 0)
+                    {
+                        runtime_error("Shift value can't be negative");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(INT_VAL(a << b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_SHIFT_ARITH_RIGHT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    if(b < 0)
+                    {
+                        runtime_error("Shift value can't be negative");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(INT_VAL(a >> b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_SHIFT_LOGIC_RIGHT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    if(b < 0)
+                    {
+                        runtime_error("Shift value can't be negative");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    if(a < 0 && b > 0)
+                    {
+                        a &= 0x7fffffffffffffff;
+                    }
+                    push(INT_VAL(a >> b));
+                }
+                else
+                {
+                    runtime_error("Operands must be integers");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_EQL)
+            {
+                Value b = pop();
+                Value a = pop();
+                if(VALUE_TYPE(a) == VAL_NULL || VALUE_TYPE(b) == VAL_NULL || VALUE_TYPE(a) == VALUE_TYPE(b))
+                {
+                    push(BOOL_VAL(values_eql(a, b)));
+                }
+                else
+                {
+                    runtime_error("Operands must be the same type");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_GREATER)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_GREATER_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(BOOL_VAL(a > b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_GREATER_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(BOOL_VAL(a > b));
+                }
+                else
+                {
+                    runtime_error("Operands must be the same type and a number");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_LESS)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    QUICKEN(OP_LESS_INT_INT);
+                    int64_t b = AS_INT(pop());
+                    int64_t a = AS_INT(pop());
+                    push(BOOL_VAL(a < b));
+                }
+                else if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    QUICKEN(OP_LESS_FLOAT_FLOAT);
+                    double b = AS_FLOAT(pop());
+                    double a = AS_FLOAT(pop());
+                    push(BOOL_VAL(a < b));
+                }
+                else
+                {
+                    runtime_error("Operands must be the same type and a number");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_ADD_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = INT_VAL(a + b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_ADD);
+            }
+            VM_CASE(OP_ADD_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = FLOAT_VAL(a + b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_ADD);
+            }
+            VM_CASE(OP_SUB_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = INT_VAL(a - b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_SUB);
+            }
+            VM_CASE(OP_SUB_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = FLOAT_VAL(a - b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_SUB);
+            }
+            VM_CASE(OP_MUL_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = INT_VAL(a * b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_MUL);
+            }
+            VM_CASE(OP_MUL_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = FLOAT_VAL(a * b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_MUL);
+            }
+            VM_CASE(OP_DIV_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    if(b == 0)
+                    {
+                        runtime_error("Divide by 0 error");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm.stack_top--;
+                    vm.stack_top[-1] = INT_VAL(a / b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_DIV);
+            }
+            VM_CASE(OP_DIV_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = FLOAT_VAL(a / b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_DIV);
+            }
+            VM_CASE(OP_GREATER_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = BOOL_VAL(a > b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_GREATER);
+            }
+            VM_CASE(OP_GREATER_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = BOOL_VAL(a > b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_GREATER);
+            }
+            VM_CASE(OP_LESS_INT_INT)
+            {
+                if(IS_INT(peek(0)) && IS_INT(peek(1)))
+                {
+                    int64_t b = AS_INT(vm.stack_top[-1]);
+                    int64_t a = AS_INT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = BOOL_VAL(a < b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_LESS);
+            }
+            VM_CASE(OP_LESS_FLOAT_FLOAT)
+            {
+                if(IS_FLOAT(peek(0)) && IS_FLOAT(peek(1)))
+                {
+                    double b = AS_FLOAT(vm.stack_top[-1]);
+                    double a = AS_FLOAT(vm.stack_top[-2]);
+                    vm.stack_top--;
+                    vm.stack_top[-1] = BOOL_VAL(a < b);
+                    VM_BREAK;
+                }
+                DEQUICKEN(OP_LESS);
+            }
+            VM_CASE(OP_CAST_BOOL)
+            {
+                Value val = pop();
+                if(IS_ROPE(val))
+                {
+                    val = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(val)));
+                }
+                switch(VALUE_TYPE(val))
+                {
+                    case VAL_BOOL:
+                    {
+                        push(val);
+                        break;
+                    }
+                    case VAL_NULL:
+                    {
+                        push(BOOL_VAL(false));
+                        break;
+                    }
+                    case VAL_INT:
+                    {
+                        push(BOOL_VAL(AS_INT(val) != 0));
+                        break;
+                    }
+                    case VAL_FLOAT:
+                    {
+                        push(BOOL_VAL(AS_FLOAT(val) != 0.0));
+                        break;
+                    }
+                    case VAL_OBJ:
+                    {
+                        switch(OBJ_TYPE(val))
+                        {
+                            case OBJ_STRING:
+                            {
+                                if(AS_STRING(val)->len == 4 && memcmp(AS_CSTRING(val), "true", 4) == 0)
+                                {
+                                    push(BOOL_VAL(true));
+                                }
+                                else if(AS_STRING(val)->len == 5 && memcmp(AS_CSTRING(val), "false", 5) == 0)
+                                {
+                                    push(BOOL_VAL(false));
+                                }
+                                else
+                                {
+                                    runtime_error("Cannot cast '%s' to bool", AS_CSTRING(val));
+                                    return INTERPRET_RUNTIME_ERROR;
+                                }
+                                break;
+                            }
+                            default:
+                            {
+                                push(BOOL_VAL(true));
+                                break;
+                            }
+                        }
+                        break;
+                    }
+                    default:
+                    {
+                        runtime_error("Unknown type");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_CAST_INT)
+            {
+                Value val = pop();
+                if(IS_ROPE(val))
+                {
+                    val = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(val)));
+                }
+                switch(VALUE_TYPE(val))
+                {
+                    case VAL_BOOL:
+                    {
+                        push(INT_VAL(AS_BOOL(val) ? 1 : 0));
+                        break;
+                    }
+                    case VAL_NULL:
+                    {
+                        push(INT_VAL(0));
+                        break;
+                    }
+                    case VAL_INT:
+                    {
+                        push(val);
+                        break;
+                    }
+                    case VAL_FLOAT:
+                    {
+                        push(INT_VAL((int64_t)AS_FLOAT(val)));
+                        break;
+                    }
+                    case VAL_OBJ:
+                    {
+                        switch(OBJ_TYPE(val))
+                        {
+                            case OBJ_STRING:
+                            {
+                                int64_t int_val = 0;
+                                if(!str_to_int(&int_val, AS_CSTRING(val), AS_STRING(val)->len))
+                                {
+                                    runtime_error("Cannot cast '%s' to int", AS_CSTRING(val));
+                                    return INTERPRET_RUNTIME_ERROR;
+                                }
+                                push(INT_VAL(int_val));
+                                break;
+                            }
+                            default:
+                            {
+                                runtime_error("Unsupported conversion of object to int");
+                                return INTERPRET_RUNTIME_ERROR;
+                            }
+                        }
+                        break;
+                    }
+                    default:
+                    {
+                        runtime_error("Unknown type");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_CAST_STR)
+            {
+                // ropes stay unflattened so interpolating into them remains linear
+                if(!IS_ROPE(peek(0)))
+                {
+                    Value val = pop();
+                    push(OBJ_VAL((Obj*)value_to_str(val)));
+                    SAFE_POINT();
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_BUILD_STRING)
+            {
+                Value* pieces = vm.stack_top - inst->arg;
+                Obj* text = build_text(pieces, inst->arg);
+                vm.stack_top = pieces;
+                push(OBJ_VAL(text));
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_CAST_FLOAT)
+            {
+                Value val = pop();
+                if(IS_ROPE(val))
+                {
+                    val = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(val)));
+                }
+                switch(VALUE_TYPE(val))
+                {
+                    case VAL_BOOL:
+                    {
+                        push(FLOAT_VAL(AS_BOOL(val) ? 1.0 : 0.0));
+                        break;
+                    }
+                    case VAL_NULL:
+                    {
+                        push(FLOAT_VAL(0.0));
+                        break;
+                    }
+                    case VAL_INT:
+                    {
+                        push(FLOAT_VAL((double)AS_INT(val)));
+                        break;
+                    }
+                    case VAL_FLOAT:
+                    {
+                        push(val);
+                        break;
+                    }
+                    case VAL_OBJ:
+                    {
+                        switch(OBJ_TYPE(val))
+                        {
+                            case OBJ_STRING:
+                            {
+                                double float_val = 0;
+                                if(!str_to_float(&float_val, AS_CSTRING(val), AS_STRING(val)->len))
+                                {
+                                    runtime_error("Cannot cast '%s' to float", AS_CSTRING(val));
+                                    return INTERPRET_RUNTIME_ERROR;
+                                }
+                                push(FLOAT_VAL(float_val));
+                                break;
+                            }
+                            default:
+                            {
+                                runtime_error("Unsupported conversion of object to float");
+                                return INTERPRET_RUNTIME_ERROR;
+                            }
+                        }
+                        break;
+                    }
+                    default:
+                    {
+                        runtime_error("Unknown type");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_POP)
+            {
+                pop();
+                VM_BREAK;
+            }
+            VM_CASE(OP_CLOSE_UPVALUE)
+            {
+                close_upvalue();
+                pop();
+                VM_BREAK;
+            }
+            VM_CASE(OP_GET_GLOBAL)
+            {
+                push(vm.chunk->globals.values[inst->arg]);
+                VM_BREAK;
+            }
+            VM_CASE(OP_SET_GLOBAL)
+            {
+                vm.chunk->globals.values[inst->arg] = peek(0);
+                VM_BREAK;
+            }
+            VM_CASE(OP_GET_UPVALUE)
+            {
+                push(*closure->upvalues[inst->arg].upvalue->value);
+                VM_BREAK;
+            }
+            VM_CASE(OP_SET_UPVALUE)
+            {
+                ObjUpvalue* upvalue = closure->upvalues[inst->arg].upvalue;
+                *upvalue->value = peek(0);
+                WRITE_BARRIER(upvalue, peek(0));
+                VM_BREAK;
+            }
+            VM_CASE(OP_GET_LOCAL)
+            {
+                push(slots[inst->arg]);
+                VM_BREAK;
+            }
+            VM_CASE(OP_SET_LOCAL)
+            {
+                slots[inst->arg] = peek(0);
+                VM_BREAK;
+            }
+            VM_CASE(OP_JUMP_IF_FALSE)
+            {
+                if(!IS_BOOL(peek(0)))
+                {
+                    runtime_error("Condition expression is not boolean");
+                }
+                if(AS_BOOL(peek(0)) == false)
+                {
+                    ip = vm.chunk->insts + inst->arg;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_JUMP_IF_TRUE)
+            {
+                if(!IS_BOOL(peek(0)))
+                {
+                    runtime_error("Condition expression is not boolean");
+                }
+                if(AS_BOOL(peek(0)) == true)
+                {
+                    ip = vm.chunk->insts + inst->arg;
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_JUMP)
+            {
+                ip = vm.chunk->insts + inst->arg;
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_INC_LOCAL)
+            {
+                // GET_LOCAL CONST ADD SET_LOCAL POP
+                Value* slot = &slots[inst->arg];
+                Value step = vm.chunk->consts.values[inst[1].arg];
+                if(IS_INT(*slot) && IS_INT(step))
+                {
+                    *slot = INT_VAL(AS_INT(*slot) + AS_INT(step));
+                    ip += 4;
+                    VM_BREAK;
+                }
+                push(*slot);
+                VM_BREAK;
+            }
+            VM_CASE(OP_INC_GLOBAL)
+            {
+                // GET_GLOBAL CONST ADD SET_GLOBAL POP
+                Value* slot = &vm.chunk->globals.values[inst->arg];
+                Value step = vm.chunk->consts.values[inst[1].arg];
+                if(IS_INT(*slot) && IS_INT(step))
+                {
+                    *slot = INT_VAL(AS_INT(*slot) + AS_INT(step));
+                    ip += 4;
+                    VM_BREAK;
+                }
+                push(*slot);
+                VM_BREAK;
+            }
+            VM_CASE(OP_LOCAL_LESS_CONST_JUMP_IF_FALSE)
+            {
+                // GET_LOCAL (CONST or GET_GLOBAL) LESS JUMP_IF_FALSE POP, jumping past the POP at the target
+                Value a = slots[inst->arg];
+                Value b = inst[1].op == OP_CONST ? vm.chunk->consts.values[inst[1].arg] : vm.chunk->globals.values[inst[1].arg];
+                if(IS_INT(a) && IS_INT(b))
+                {
+                    // as signed values, ints are unsigned in the union without NAN_BOXING
+                    int64_t x = AS_INT(a);
+                    int64_t y = AS_INT(b);
+                    if(x < y)
+                    {
+                        ip += 4;
+                    }
+                    else
+                    {
+                        ip = vm.chunk->insts + inst[3].arg + 1;
+                    }
+                    VM_BREAK;
+                }
+                push(a);
+                VM_BREAK;
+            }
+            VM_CASE(OP_LOCAL_LESS_EQL_CONST_JUMP_IF_FALSE)
+            {
+                // GET_LOCAL (CONST or GET_GLOBAL) GREATER NOT JUMP_IF_FALSE POP
+                Value a = slots[inst->arg];
+                Value b = inst[1].op == OP_CONST ? vm.chunk->consts.values[inst[1].arg] : vm.chunk->globals.values[inst[1].arg];
+                if(IS_INT(a) && IS_INT(b))
+                {
+                    int64_t x = AS_INT(a);
+                    int64_t y = AS_INT(b);
+                    if(x <= y)
+                    {
+                        ip += 5;
+                    }
+                    else
+                    {
+                        ip = vm.chunk->insts + inst[4].arg + 1;
+                    }
+                    VM_BREAK;
+                }
+                push(a);
+                VM_BREAK;
+            }
+            VM_CASE(OP_SET_LOCAL_POP)
+            {
+                slots[inst->arg] = pop();
+                ip++;
+                VM_BREAK;
+            }
+            VM_CASE(OP_SET_GLOBAL_POP)
+            {
+                vm.chunk->globals.values[inst->arg] = pop();
+                ip++;
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_ADD)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    REG_WRITE(INT_VAL(AS_INT(b) + AS_INT(c)));
+                    VM_BREAK;
+                }
+                if(IS_FLOAT(b) && IS_FLOAT(c))
+                {
+                    REG_WRITE(FLOAT_VAL(AS_FLOAT(b) + AS_FLOAT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_SUB)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    REG_WRITE(INT_VAL(AS_INT(b) - AS_INT(c)));
+                    VM_BREAK;
+                }
+                if(IS_FLOAT(b) && IS_FLOAT(c))
+                {
+                    REG_WRITE(FLOAT_VAL(AS_FLOAT(b) - AS_FLOAT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_MUL)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    REG_WRITE(INT_VAL(AS_INT(b) * AS_INT(c)));
+                    VM_BREAK;
+                }
+                if(IS_FLOAT(b) && IS_FLOAT(c))
+                {
+                    REG_WRITE(FLOAT_VAL(AS_FLOAT(b) * AS_FLOAT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_EQL)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    REG_WRITE(BOOL_VAL(AS_INT(b) == AS_INT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_LESS)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    int64_t x = AS_INT(b);
+                    int64_t y = AS_INT(c);
+                    REG_WRITE(BOOL_VAL(x < y));
+                    VM_BREAK;
+                }
+                if(IS_FLOAT(b) && IS_FLOAT(c))
+                {
+                    REG_WRITE(BOOL_VAL(AS_FLOAT(b) < AS_FLOAT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_REG_GREATER)
+            {
+                Value b = REG_READ(REG_SRC1(inst));
+                Value c = REG_READ(REG_SRC2(inst));
+                if(IS_INT(b) && IS_INT(c))
+                {
+                    int64_t x = AS_INT(b);
+                    int64_t y = AS_INT(c);
+                    REG_WRITE(BOOL_VAL(x > y));
+                    VM_BREAK;
+                }
+                if(IS_FLOAT(b) && IS_FLOAT(c))
+                {
+                    REG_WRITE(BOOL_VAL(AS_FLOAT(b) > AS_FLOAT(c)));
+                    VM_BREAK;
+                }
+                // run the rest of the sequence as stack code
+                push(b);
+                VM_BREAK;
+            }
+            VM_CASE(OP_INIT_ARRAY)
+            {
+                if(!IS_INT(peek(0)))
+                {
+                    runtime_error("Must have integer size for array");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(AS_INT(peek(0)) <= 0)
+                {
+                    runtime_error("Array size must be greater than 0");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value size = pop();
+                Value val = pop();
+                push(OBJ_VAL((Obj*)build_array(AS_INT(size), val)));
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_FILL_ARRAY)
+            {
+                if(!IS_INT(peek(0)))
+                {
+                    runtime_error("Must have integer size for array");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(AS_INT(peek(0)) <= 0)
+                {
+                    runtime_error("Array size must be greater than 0");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value size = pop();
+                ObjArray* array = build_array(AS_INT(size), NULL_VAL);
+                for(size_t i = AS_INT(size); i > 0; i--)
+                {
+                    array->data[i - 1] = pop();
+                }
+                push(OBJ_VAL((Obj*)array));
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_INDEX_GET)
+            {
+                if(!IS_ARRAY(peek(1)) && !IS_TEXT(peek(1)))
+                {
+                    runtime_error("Cannot index value");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(!IS_INT(peek(0)))
+                {
+                    runtime_error("Must have integer index");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(AS_INT(peek(0)) < 0)
+                {
+                    runtime_error("Index can't be negative");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value index = pop();
+                Value array = pop();
+                if(IS_ARRAY(array))
+                {
+                    if(AS_INT(index) >= AS_ARRAY(array)->len)
+                    {
+                        runtime_error("Index is beyond array's bounds");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(AS_CARRAY(array)[AS_INT(index)]);
+                }
+                else
+                {
+                    if(IS_ROPE(array))
+                    {
+                        array = OBJ_VAL((Obj*)flatten_rope(AS_ROPE(array)));
+                    }
+                    if(AS_INT(index) >= AS_STRING(array)->len)
+                    {
+                        runtime_error("Index is beyond string's bounds");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    // indexes bytes, code_point_at counts characters
+                    push(OBJ_VAL((Obj*)vm.char_strs[(uint8_t)AS_CSTRING(array)[AS_INT(index)]]));
+                    SAFE_POINT();
+                }
+                VM_BREAK;
+            }
+            VM_CASE(OP_INDEX_PEEK)
+            {
+                if(!IS_ARRAY(peek(1))) 
+                {
+                    runtime_error("Cannot index value");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(!IS_INT(peek(0)))
+                {
+                    runtime_error("Must have integer index");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(AS_INT(peek(0)) < 0)
+                {
+                    runtime_error("Index can't be negative");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value index = peek(0);
+                Value array = peek(1);
+                push(AS_CARRAY(array)[AS_INT(index)]);
+                VM_BREAK;
+            }
+            VM_CASE(OP_INDEX_SET)
+            {
+                if(!IS_ARRAY(peek(2)))
+                {
+                    runtime_error("Cannot index value");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(!IS_INT(peek(1)))
+                {
+                    runtime_error("Must have integer index");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(AS_INT(peek(1)) < 0)
+                {
+                    runtime_error("Index can't be negative");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value val = pop();
+                Value index = pop();
+                Value array = pop();
+                if(AS_INT(index) >= AS_ARRAY(array)->len)
+                {
+                    runtime_error("Index is beyond value's bounds");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                AS_CARRAY(array)[AS_INT(index)] = val;
+                WRITE_BARRIER(AS_OBJ(array), val);
+                push(array);
+                VM_BREAK;
+            }
+            VM_CASE(OP_CALL)
+            {
+                SAFE_POINT();
+                if(!call_value(peek(inst->args), inst->args, 0))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ip = vm.ip;
+                slots = vm.stack_base;
+                closure = vm.closure;
+                VM_BREAK;
+            }
+            VM_CASE(OP_TAIL_CALL)
+            {
+                SAFE_POINT();
+                if(!tail_call(peek(inst->args), inst->args))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ip = vm.ip;
+                slots = vm.stack_base;
+                closure = vm.closure;
+                VM_BREAK;
+            }
+            VM_CASE(OP_INVOKE)
+            {
+                SAFE_POINT();
+                if(!invoke(READ_STRING(inst->arg), READ_CACHE(), false, inst->args))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ip = vm.ip;
+                slots = vm.stack_base;
+                closure = vm.closure;
+                VM_BREAK;
+            }
+            VM_CASE(OP_INVOKE_THIS)
+            {
+                SAFE_POINT();
+                if(!invoke(READ_STRING(inst->arg), READ_CACHE(), true, inst->args))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ip = vm.ip;
+                slots = vm.stack_base;
+                closure = vm.closure;
+                VM_BREAK;
+            }
+            VM_CASE(OP_CLOSURE)
+            {
+                ObjClosure* inner = AS_CLOSURE(vm.chunk->consts.values[inst->arg]);
+                init_closure(inner);
+                push(OBJ_VAL((Obj*)inner));
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_ATTR)
+            {
+                define_attr(READ_STRING(inst->arg), inst->scope);
+                SAFE_POINT();
+                VM_BREAK;
+            }
+            VM_CASE(OP_ATTR_GET)
+            {
+                if(get_attr(READ_STRING(inst->arg), true, READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_CASE(OP_ATTR_PEEK)
+            {
+                if(get_attr(READ_STRING(inst->arg), false, READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_CASE(OP_ATTR_SET)
+            {
+                if(set_attr(READ_STRING(inst->arg), READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_CASE(OP_ATTR_GET_THIS)
+            {
+                if(get_this_attr(READ_STRING(inst->arg), true, READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_CASE(OP_ATTR_PEEK_THIS)
+            {
+                if(get_this_attr(READ_STRING(inst->arg), false, READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_CASE(OP_ATTR_SET_THIS)
+            {
+                if(set_this_attr(READ_STRING(inst->arg), READ_CACHE()))
+                {
+                    VM_BREAK;
+                }
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_DEFAULT
+            {
+                runtime_error("Unknown instruction %u", inst->op);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+    vm.running = false;
+}